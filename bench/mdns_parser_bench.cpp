@@ -0,0 +1,134 @@
+// Times mDNSParser::parse_response and counts the heap allocations it makes, on a response
+// from a robot module and on unrelated mDNS traffic, which is most of what a busy network
+// delivers and should be parsed without allocating at all.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "mDNSParser.h"
+
+constexpr auto ITERATIONS = 1'000'000;
+
+static std::atomic<uint64_t> allocations = 0;
+
+void *operator new(const std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept {
+    std::free(p);
+}
+
+static void write_name(std::vector<uint8_t> &packet, std::string_view name) {
+    while (!name.empty()) {
+        const auto dot = name.find('.');
+        const auto label = name.substr(0, dot);
+        packet.push_back(static_cast<uint8_t>(label.size()));
+        packet.insert(packet.end(), label.begin(), label.end());
+        name = dot == std::string_view::npos ? std::string_view{} : name.substr(dot + 1);
+    }
+    packet.push_back(0);
+}
+
+static void write_u16(std::vector<uint8_t> &packet, const uint16_t value) {
+    packet.push_back(static_cast<uint8_t>(value >> 8));
+    packet.push_back(static_cast<uint8_t>(value));
+}
+
+static void write_record_header(std::vector<uint8_t> &packet, const uint16_t type,
+                                const uint32_t ttl, const uint16_t length) {
+    write_u16(packet, type);
+    write_u16(packet, 0x8001); // IN, cache flush
+    write_u16(packet, static_cast<uint16_t>(ttl >> 16));
+    write_u16(packet, static_cast<uint16_t>(ttl));
+    write_u16(packet, length);
+}
+
+static std::vector<uint8_t> header(const uint16_t answers, const uint16_t additional) {
+    std::vector<uint8_t> packet;
+    for (const uint16_t field : {uint16_t{0}, uint16_t{0x8400}, uint16_t{0}, answers,
+                                 uint16_t{0}, additional}) {
+        write_u16(packet, field);
+    }
+    return packet;
+}
+
+// PTR, TXT and A records for module 12, names compressed the way ESP-IDF's mDNS writes them.
+static std::vector<uint8_t> robot_module_response() {
+    auto packet = header(1, 2);
+    const auto service = static_cast<uint16_t>(packet.size());
+    write_name(packet, "_robotcontrol._tcp.local");
+    write_record_header(packet, 12, 4500, 12);
+    const auto instance = static_cast<uint16_t>(packet.size());
+    write_name(packet, "module-12");
+    packet.pop_back();
+    write_u16(packet, 0xC000 | service);
+
+    constexpr std::string_view entries[] = {"module_id=12", "module_type=1",
+                                            "connected_modules=3,4", "compression=lz"};
+    uint16_t txt_length = 0;
+    for (const auto entry : entries) {
+        txt_length += static_cast<uint16_t>(entry.size() + 1);
+    }
+    write_u16(packet, 0xC000 | instance);
+    write_record_header(packet, 16, 120, txt_length);
+    for (const auto entry : entries) {
+        packet.push_back(static_cast<uint8_t>(entry.size()));
+        packet.insert(packet.end(), entry.begin(), entry.end());
+    }
+
+    write_u16(packet, 0xC000 | instance);
+    write_record_header(packet, 1, 120, 4);
+    packet.insert(packet.end(), {192, 168, 1, 12});
+    return packet;
+}
+
+static std::vector<uint8_t> foreign_response() {
+    std::vector<uint8_t> instance;
+    write_name(instance, "Living Room._airplay._tcp.local");
+
+    auto packet = header(1, 0);
+    write_name(packet, "_airplay._tcp.local");
+    write_record_header(packet, 12, 4500, static_cast<uint16_t>(instance.size()));
+    packet.insert(packet.end(), instance.begin(), instance.end());
+    return packet;
+}
+
+static void run(const char *label, const std::vector<uint8_t> &packet) {
+    size_t parsed = 0;
+    const auto allocations_before = allocations.load();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < ITERATIONS; i++) {
+        parsed += mDNSParser::parse_response(std::span(packet)).has_value();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const auto allocated = allocations.load() - allocations_before;
+
+    std::printf("%-16s %6zu bytes  %8.1f ns/packet  %6.2f allocations/packet  %zu parsed\n",
+                label, packet.size(),
+                std::chrono::duration<double, std::nano>(elapsed).count() / ITERATIONS,
+                static_cast<double>(allocated) / ITERATIONS, parsed);
+}
+
+int main() {
+    const auto robot_module = robot_module_response();
+    const auto foreign = foreign_response();
+    run("robot module", robot_module);
+    run("foreign service", foreign);
+    return 0;
+}
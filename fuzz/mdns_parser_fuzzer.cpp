@@ -0,0 +1,56 @@
+// Fuzzes mDNSParser. Built with clang the entry point is driven by libFuzzer, for example
+//   mdns_parser_fuzzer -max_len=1500 corpus/ ../fuzz/corpus/mdns_parser
+// With other compilers main replays the files and directories given on the command line, so
+// the corpus still runs as a regression check under the sanitizers.
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <span>
+#include <vector>
+
+#include "mDNSParser.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, const size_t size) {
+    const std::span packet(data, size);
+    mDNSParser::parse_response(packet);
+
+    // Names can start anywhere a record points, so decode one from every offset.
+    mDNSName name;
+    for (size_t offset = 0; offset < packet.size(); offset++) {
+        if (const auto end = mDNSParser::read_name(packet, offset, name)) {
+            if (*end <= offset || *end > packet.size() || name.length > name.data.size()) {
+                __builtin_trap();
+            }
+        }
+    }
+    return 0;
+}
+
+#ifndef LIBRPC_LIBFUZZER
+static void run_file(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    const std::vector<uint8_t> data{std::istreambuf_iterator<char>(file), {}};
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+int main(const int argc, char **argv) {
+    size_t inputs = 0;
+    for (int i = 1; i < argc; i++) {
+        const std::filesystem::path path(argv[i]);
+        if (std::filesystem::is_directory(path)) {
+            for (const auto &entry : std::filesystem::directory_iterator(path)) {
+                run_file(entry.path());
+                inputs++;
+            }
+        } else {
+            run_file(path);
+            inputs++;
+        }
+    }
+    std::printf("Ran %zu inputs\n", inputs);
+    return 0;
+}
+#endif
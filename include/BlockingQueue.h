@@ -7,24 +7,75 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
 #include <mutex>
 #include <optional>
-#include <queue>
+
+// What enqueue does when the queue is full.
+enum class OverflowPolicy {
+    Block,      // wait up to max_wait for space, then reject the new item
+    DropNewest, // reject the new item straight away
+    DropOldest, // evict the oldest item to make room
+    Conflate,   // replace the queued item with the same key in place, else evict the oldest
+};
+
+struct QueueStats {
+    uint64_t enqueued = 0;
+    uint64_t dropped = 0;   // new items rejected
+    uint64_t evicted = 0;   // queued items dropped to make room
+    uint64_t conflated = 0; // queued items replaced by a newer one with the same key
+};
 
 template <typename T> class BlockingQueue {
   public:
-    explicit BlockingQueue(const size_t capacity) : m_capacity(capacity) {
+    using KeyFunction = std::function<uint64_t(const T &)>;
+
+    explicit BlockingQueue(const size_t capacity,
+                           const OverflowPolicy policy = OverflowPolicy::Block,
+                           KeyFunction key = nullptr)
+        : m_capacity(capacity), m_policy(policy), m_key(std::move(key)) {
     }
 
-    // Enqueue with timeout. Returns true on success, false on timeout.
+    // Enqueue with timeout. Returns true on success, false if the item was dropped. Only the
+    // Block policy ever waits.
     bool enqueue(T &&item, std::chrono::milliseconds max_wait) {
         std::unique_lock lock(m_mutex);
-        if (!m_cond_not_full.wait_for(lock, max_wait,
-                                      [this]() { return m_queue.size() < m_capacity; })) {
-            return false;
+
+        if (m_policy == OverflowPolicy::Conflate && m_key) {
+            const auto key = m_key(item);
+            for (auto &queued : m_queue) {
+                if (m_key(queued) == key) {
+                    queued = std::move(item);
+                    m_stats.conflated++;
+                    return true;
+                }
+            }
         }
 
-        m_queue.push(std::move(item));
+        if (m_queue.size() >= m_capacity) {
+            switch (m_policy) {
+            case OverflowPolicy::Block:
+                if (!m_cond_not_full.wait_for(lock, max_wait,
+                                              [this]() { return m_queue.size() < m_capacity; })) {
+                    m_stats.dropped++;
+                    return false;
+                }
+                break;
+            case OverflowPolicy::DropNewest:
+                m_stats.dropped++;
+                return false;
+            case OverflowPolicy::DropOldest:
+            case OverflowPolicy::Conflate:
+                m_queue.pop_front();
+                m_stats.evicted++;
+                break;
+            }
+        }
+
+        m_queue.push_back(std::move(item));
+        m_stats.enqueued++;
         m_cond_not_empty.notify_one();
         return true;
     }
@@ -37,14 +88,41 @@ template <typename T> class BlockingQueue {
         }
 
         T item = std::move(m_queue.front());
-        m_queue.pop();
+        m_queue.pop_front();
         m_cond_not_full.notify_one();
         return item;
     }
 
+    // Dequeue without waiting. Returns optional<T> (empty if nothing is queued).
+    std::optional<T> try_dequeue() {
+        std::unique_lock lock(m_mutex);
+        if (m_queue.empty()) {
+            return std::nullopt;
+        }
+
+        T item = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_cond_not_full.notify_one();
+        return item;
+    }
+
+    void set_policy(const OverflowPolicy policy, KeyFunction key = nullptr) {
+        std::scoped_lock lock(m_mutex);
+        m_policy = policy;
+        m_key = std::move(key);
+    }
+
+    QueueStats stats() {
+        std::scoped_lock lock(m_mutex);
+        return m_stats;
+    }
+
   private:
-    std::queue<T> m_queue;
+    std::deque<T> m_queue;
     size_t m_capacity;
+    OverflowPolicy m_policy;
+    KeyFunction m_key;
+    QueueStats m_stats;
     std::mutex m_mutex;
     std::condition_variable m_cond_not_empty;
     std::condition_variable m_cond_not_full;
@@ -0,0 +1,36 @@
+#ifndef CLIENTFACTORY_H
+#define CLIENTFACTORY_H
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "ICommunicationClient.h"
+#include "PriorityRxQueue.h"
+#include "mDNSRobotModule.h"
+
+// Connects a client of type T to every module not in skip_modules, shared by the discovery
+// services.
+template <typename T>
+std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> create_clients(
+    const std::unordered_map<uint8_t, mDNSRobotModule> &modules,
+    const std::shared_ptr<PriorityRxQueue> &rx_queue,
+    const std::vector<uint8_t> &skip_modules) {
+    std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> clients;
+
+    for (const auto &[id, module] : modules) {
+        if (std::find(skip_modules.begin(), skip_modules.end(), id) != skip_modules.end()) {
+            continue;
+        }
+
+        // Modules behind this one are reached through the RoutingTable, not extra entries here.
+        const auto client = std::make_shared<T>(module.ip, rx_queue);
+        client->init();
+        clients[id] = client;
+    }
+
+    return clients;
+}
+
+#endif // CLIENTFACTORY_H
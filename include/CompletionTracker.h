@@ -0,0 +1,43 @@
+#ifndef COMPLETIONTRACKER_H
+#define COMPLETIONTRACKER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Waits for one message on a tag from each of a set of modules. sendrecv and the collectives
+// register one with the dispatcher, which completes it as the messages arrive, so any number of
+// outstanding replies costs the caller a single wait.
+class CompletionTracker {
+  public:
+    CompletionTracker(std::vector<uint8_t> sources, uint8_t tag);
+
+    const std::vector<uint8_t> &sources() const {
+        return m_sources;
+    }
+
+    uint8_t tag() const {
+        return m_tag;
+    }
+
+    void complete(uint8_t source, std::unique_ptr<std::vector<uint8_t>> message);
+
+    // Returns true once every source has completed, false if the timeout ran out first.
+    bool wait_for(std::chrono::milliseconds timeout);
+
+    // The messages received so far, keyed by source.
+    std::unordered_map<uint8_t, std::unique_ptr<std::vector<uint8_t>>> take_results();
+
+  private:
+    std::vector<uint8_t> m_sources;
+    uint8_t m_tag;
+    std::unordered_map<uint8_t, std::unique_ptr<std::vector<uint8_t>>> m_results;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+#endif // COMPLETIONTRACKER_H
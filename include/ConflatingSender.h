@@ -0,0 +1,51 @@
+#ifndef CONFLATINGSENDER_H
+#define CONFLATINGSENDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Sends only the latest payload per (destination, tag, durable). A payload submitted while an
+// older one for the same stream is still waiting replaces it in place, keeping its place in line,
+// so under overload modules get the newest setpoint instead of a growing backlog of stale ones.
+// Every destination has its own thread, a module that is slow to take its sends only holds up
+// its own streams.
+class ConflatingSender {
+  public:
+    // Returns a negative value if the payload could not be sent.
+    using SendFunction = std::function<int(uint8_t destination, uint8_t tag, bool durable,
+                                           std::vector<uint8_t> &payload)>;
+
+    explicit ConflatingSender(SendFunction send);
+    ~ConflatingSender();
+
+    void submit(uint8_t destination, uint8_t tag, bool durable, std::vector<uint8_t> payload);
+    uint64_t conflated() const {
+        return m_conflated;
+    }
+
+  private:
+    struct Destination {
+        std::unordered_map<uint16_t, std::vector<uint8_t>> pending; // keyed by tag << 1 | durable
+        std::deque<uint16_t> order;
+        bool stop = false;
+        std::condition_variable cond;
+        std::thread thread;
+    };
+
+    void send_thread(uint8_t destination, Destination &state);
+
+    SendFunction m_send;
+    std::unordered_map<uint8_t, std::unique_ptr<Destination>> m_destinations;
+    std::atomic<uint64_t> m_conflated = 0;
+    std::mutex m_mutex;
+};
+
+#endif // CONFLATINGSENDER_H
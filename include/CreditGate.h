@@ -0,0 +1,106 @@
+#ifndef CREDITGATE_H
+#define CREDITGATE_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+constexpr auto CREDIT_HOLD_QUEUE_SIZE = 64; // durable messages held per module for credits
+constexpr auto MAX_CREDITS = 4096;         // guards against a module granting without bound
+
+// What a durable send does when the destination has no credits left.
+enum class CreditPolicy {
+    Hold,     // keep the message until credits come back, up to CREDIT_HOLD_QUEUE_SIZE
+    FailFast, // fail the send straight away
+};
+
+enum class CreditResult {
+    Granted, // send now
+    Held,    // release will send it once credits come back
+    Exhausted,
+};
+
+struct CreditStats {
+    int credits = 0;
+    size_t held = 0;
+    uint64_t exhausted = 0; // sends failed for lack of credits
+};
+
+// Receive credits modules hand out for durable messages. Every MPIMessage a module sends may
+// carry a grant in its credits field, the number of further messages it has room for: its
+// initial window in the first, then one per message it has consumed, piggybacked on replies
+// and state reports. Credits are kept per link, like pacing: module is the module at the other
+// end of the connection, and the host spends one per durable message sent over it. A module
+// that never granted any is not flow controlled at all, which keeps older firmware working.
+class CreditGate {
+  public:
+    // release(true) sends a held message, release(false) fails it.
+    using Release = std::move_only_function<void(bool)>;
+
+    ~CreditGate();
+
+    // Spends one of module's credits. Without one, make_release() is held until credits come
+    // back when hold is set. Messages behind held ones are held too, so order is kept.
+    template <typename F> CreditResult acquire(const uint8_t module, const bool hold,
+                                               F &&make_release) {
+        std::scoped_lock lock(m_mutex);
+        const auto it = m_modules.find(module);
+        if (it == m_modules.end()) {
+            return CreditResult::Granted;
+        }
+
+        auto &state = it->second;
+        if (state.held.empty() && !state.releasing && state.credits > 0) {
+            state.credits--;
+            return CreditResult::Granted;
+        }
+        if (!hold || state.held.size() >= CREDIT_HOLD_QUEUE_SIZE) {
+            state.exhausted++;
+            return CreditResult::Exhausted;
+        }
+        state.held.push_back(make_release());
+        return CreditResult::Held;
+    }
+
+    // Adds credits granted by module, and sends the held messages they cover.
+    void grant(uint8_t module, uint8_t credits);
+    // The connection to module came back, and with it an empty window: its credits start over
+    // from the module's next grant. make_replay() returns the messages to send again, which are
+    // held ahead of those already waiting. Returns false, without calling make_replay, if module
+    // is not flow controlled.
+    template <typename F> bool reset(const uint8_t module, F &&make_replay) {
+        std::scoped_lock lock(m_mutex);
+        const auto it = m_modules.find(module);
+        if (it == m_modules.end()) {
+            return false;
+        }
+
+        auto &state = it->second;
+        state.credits = 0;
+        auto replay = make_replay();
+        for (auto release = replay.rbegin(); release != replay.rend(); ++release) {
+            state.held.push_front(std::move(*release));
+        }
+        return true;
+    }
+    // Forgets module, failing its held messages. It starts out unlimited again.
+    void remove(uint8_t module);
+    // nullopt while module has never granted credits.
+    std::optional<CreditStats> stats(uint8_t module);
+
+  private:
+    struct State {
+        int credits = 0;
+        std::deque<Release> held;
+        bool releasing = false; // a grant is sending held messages, new ones queue behind them
+        uint64_t exhausted = 0;
+    };
+
+    std::unordered_map<uint8_t, State> m_modules;
+    std::mutex m_mutex;
+};
+
+#endif // CREDITGATE_H
@@ -0,0 +1,20 @@
+#ifndef DISCOVERYCACHE_H
+#define DISCOVERYCACHE_H
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+#include "mDNSRobotModule.h"
+
+// Reads and writes the last known modules, one per line:
+// <id> <ip> <hostname> <module_type> <connected ids, comma separated, or -> [lz]
+// The trailing lz marks a module that accepts compressed payloads, and may be left out.
+class DiscoveryCache {
+  public:
+    static std::vector<mDNSRobotModule> load(const std::filesystem::path &path);
+    static bool save(const std::filesystem::path &path,
+                     const std::unordered_map<uint8_t, mDNSRobotModule> &modules);
+};
+
+#endif // DISCOVERYCACHE_H
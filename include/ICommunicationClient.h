@@ -5,11 +5,34 @@
 #ifndef INETWORKCLIENT_H
 #define INETWORKCLIENT_H
 
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "MessagePriority.h"
+
 class ICommunicationClient {
   public:
     virtual ~ICommunicationClient() = default;
     virtual int init() = 0;
+    // Called from several threads at once: senders, the pacer's link workers and the heartbeat
+    // thread. Implementations keep every message whole on the wire.
     virtual int send_msg(void *sendbuff, uint32_t len) = 0;
+    // Transports that cannot tell priority classes apart on the wire send as usual.
+    virtual int send_msg(void *sendbuff, const uint32_t len, MessagePriority /* priority */) {
+        return send_msg(sendbuff, len);
+    }
+
+    // Frames to resend when a dropped connection comes back, before anything else goes out.
+    using ReplaySource = std::function<std::vector<std::vector<uint8_t>>()>;
+    // Transports that never reconnect ignore it.
+    virtual void set_replay_source(ReplaySource /* source */) {
+    }
+
+    // Gives up on a connection that stopped answering, so it is dialled again. Transports
+    // without a connection ignore it.
+    virtual void drop_connection() {
+    }
 };
 
 #endif // INETWORKCLIENT_H
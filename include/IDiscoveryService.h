@@ -4,20 +4,31 @@
 
 #ifndef IDISCOVERYSERVICE_H
 #define IDISCOVERYSERVICE_H
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "ICommunicationClient.h"
+#include "PriorityRxQueue.h"
 #include "mDNSRobotModule.h"
 
+enum class ModuleEvent { Added, Removed, Updated };
+
+using ModuleEventCallback = std::function<void(ModuleEvent, const mDNSRobotModule &)>;
+
 class IDiscoveryService {
   public:
     virtual ~IDiscoveryService() = default;
     virtual std::unordered_set<uint8_t> find_modules(std::chrono::duration<double> wait_time) = 0;
+    virtual std::unordered_map<uint8_t, mDNSRobotModule> get_modules() = 0;
+    virtual void add_module_callback(ModuleEventCallback callback) = 0;
     virtual std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> get_lossy_clients(
-        const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
+        const std::shared_ptr<PriorityRxQueue> &rx_queue,
         std::vector<uint8_t> &skip_modules) = 0;
     virtual std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> get_lossless_clients(
-        const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
+        const std::shared_ptr<PriorityRxQueue> &rx_queue,
         std::vector<uint8_t> &skip_modules) = 0;
 };
 
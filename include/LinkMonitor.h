@@ -0,0 +1,61 @@
+#ifndef LINKMONITOR_H
+#define LINKMONITOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+constexpr auto RTO_MIN = std::chrono::milliseconds(20);
+constexpr auto RTO_MAX = std::chrono::seconds(10);
+
+struct RttEstimate {
+    std::chrono::microseconds srtt;
+    std::chrono::microseconds rttvar;
+    std::chrono::microseconds rto; // srtt + 4 rttvar, clamped to [RTO_MIN, RTO_MAX]
+    uint64_t samples;
+};
+
+// Smoothed round trip time and its mean deviation, as TCP keeps them (RFC 6298).
+class RttEstimator {
+  public:
+    void sample(std::chrono::microseconds rtt);
+    std::optional<RttEstimate> estimate() const;
+
+  private:
+    std::chrono::microseconds m_srtt{0};
+    std::chrono::microseconds m_rttvar{0};
+    uint64_t m_samples = 0;
+};
+
+// Liveness and RTT of every module we hold a connection to, fed by heartbeats. Any message
+// from a module counts as a sign of life, so a busy module is never declared dead for a
+// heartbeat reply stuck behind its traffic.
+class LinkMonitor {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // Lock free, called for every message the dispatcher sees.
+    void heard_from(uint8_t module, Clock::time_point now = Clock::now());
+    void record_rtt(uint8_t module, std::chrono::microseconds rtt);
+    void remove(uint8_t module);
+
+    // Modules that have answered heartbeats before but have not been heard from in timeout
+    // plus their RTO. Modules that never answered one are left alone, their firmware may not
+    // echo heartbeats. A module is only reported once, until it is heard from again.
+    std::vector<uint8_t> silent_modules(std::chrono::milliseconds timeout,
+                                        Clock::time_point now = Clock::now());
+    std::optional<RttEstimate> estimate(uint8_t module) const;
+
+  private:
+    std::array<std::atomic<Clock::rep>, 256> m_last_heard{};
+    std::array<std::atomic<bool>, 256> m_reported_silent{};
+    std::unordered_map<uint8_t, RttEstimator> m_estimators; // modules that answered heartbeats
+    mutable std::mutex m_mutex;
+};
+
+#endif // LINKMONITOR_H
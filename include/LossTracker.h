@@ -0,0 +1,51 @@
+#ifndef LOSSTRACKER_H
+#define LOSSTRACKER_H
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+constexpr auto LOSS_WINDOW = 64; // how far behind the newest datagram a late one is recognised
+
+struct LossStats {
+    uint64_t received = 0;
+    uint64_t lost = 0;       // sequence numbers skipped and not (yet) seen late
+    uint64_t duplicates = 0;
+    uint64_t reordered = 0;  // arrived after a newer one from the same stream
+    uint64_t dropped_stale = 0;
+};
+
+enum class Arrival {
+    InOrder,
+    Late, // older than the newest seen, first time
+    Duplicate,
+};
+
+// Follows the sequence numbers of lossy messages, numbered per (sender, tag) stream, to tell
+// link loss, duplication and reordering apart. A number further back than LOSS_WINDOW is too
+// old to tell and counts as late. A new session of the sender starts its streams over.
+class LossTracker {
+  public:
+    // Only called by the dispatcher.
+    Arrival track(uint8_t sender, uint8_t tag, uint16_t sequence, uint32_t session);
+    // Starts the sender's streams over, for a sender that went away.
+    void reset(uint8_t sender);
+    void count_stale_drop(uint8_t sender);
+    LossStats stats(uint8_t module);
+
+  private:
+    struct Stream {
+        uint16_t newest = 0;
+        uint64_t seen = 0; // bit i is newest - i
+    };
+
+    void erase_streams(uint8_t sender);
+
+    std::unordered_map<uint16_t, Stream> m_streams; // keyed by sender << 8 | tag
+    std::array<uint32_t, 256> m_sessions{};
+    std::array<LossStats, 256> m_stats{};
+    std::mutex m_mutex;
+};
+
+#endif // LOSSTRACKER_H
@@ -0,0 +1,67 @@
+#ifndef MESSAGEAGGREGATOR_H
+#define MESSAGEAGGREGATOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "ICommunicationClient.h"
+#include "MessagePriority.h"
+#include "constants.h"
+#include "flatbuffers_generated/MPIMessage_generated.h"
+
+// Leave room for the outer MPIMessage and the transport length prefix.
+constexpr auto AGGREGATE_MAX_FRAME_SIZE = MAX_BUFFER_SIZE - 128;
+
+// Packs serialized MPIMessages bound for the same client into a single
+// MessageType_AGGREGATE frame. The frame payload is a sequence of
+// [uint16_t length][MPIMessage bytes] entries. Each priority class is packed into frames of its
+// own, carrying that class, so the receiver queues them in the right lane.
+class MessageAggregator {
+  public:
+    MessageAggregator(std::chrono::microseconds max_delay, size_t max_frame_size);
+    ~MessageAggregator();
+
+    int enqueue(const std::shared_ptr<ICommunicationClient> &client, bool durable,
+                MessagePriority priority, const uint8_t *data, size_t size);
+    void flush();
+
+    static void unpack(const Messaging::MPIMessage *frame,
+                       const std::function<void(const uint8_t *, size_t)> &callback);
+
+  private:
+    using FrameKey = std::pair<ICommunicationClient *, MessagePriority>;
+
+    struct PendingFrame {
+        std::shared_ptr<ICommunicationClient> client;
+        bool durable = false;
+        MessagePriority priority = MessagePriority::Normal;
+        uint16_t count = 0;
+        std::vector<uint8_t> payload;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    void flush_thread();
+    void flush_expired();
+    std::vector<PendingFrame> take_frames(ICommunicationClient *client);
+    static int send_frame(PendingFrame &frame);
+
+    std::chrono::microseconds m_max_delay;
+    size_t m_max_frame_size;
+    // Ordered, so the frames of a client are next to each other.
+    std::map<FrameKey, PendingFrame> m_pending;
+    std::atomic<bool> m_stop_flag;
+    std::mutex m_mutex;
+    std::mutex m_send_mutex; // keeps frames for the same client in order
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+#endif // MESSAGEAGGREGATOR_H
@@ -0,0 +1,43 @@
+#ifndef MESSAGEPRIORITY_H
+#define MESSAGEPRIORITY_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Priority class of a message, carried in bits 1-2 of the MPIMessage flags. Normal is zero so
+// messages from senders that predate priorities keep their behaviour. Classes are kept apart
+// when receiving; sending over TCP they share one stream.
+enum class MessagePriority : uint8_t {
+    Normal = 0,
+    Bulk = 1,     // telemetry dumps, large RPC replies
+    Critical = 2, // emergency stop, setpoint acks
+};
+
+constexpr size_t PRIORITY_CLASSES = 3;
+constexpr uint8_t MPI_FLAG_PRIORITY_SHIFT = 1;
+constexpr uint8_t MPI_FLAG_PRIORITY_MASK = 0b11 << MPI_FLAG_PRIORITY_SHIFT;
+
+inline uint8_t priority_flags(const MessagePriority priority) {
+    return static_cast<uint8_t>(static_cast<uint8_t>(priority) << MPI_FLAG_PRIORITY_SHIFT);
+}
+
+inline MessagePriority message_priority(const uint8_t flags) {
+    const auto value =
+        static_cast<size_t>((flags & MPI_FLAG_PRIORITY_MASK) >> MPI_FLAG_PRIORITY_SHIFT);
+    return value < PRIORITY_CLASSES ? static_cast<MessagePriority>(value) : MessagePriority::Normal;
+}
+
+// Lane index, lower lanes are always served first.
+inline size_t priority_lane(const MessagePriority priority) {
+    switch (priority) {
+    case MessagePriority::Critical:
+        return 0;
+    case MessagePriority::Normal:
+        return 1;
+    case MessagePriority::Bulk:
+        return 2;
+    }
+    return 1;
+}
+
+#endif // MESSAGEPRIORITY_H
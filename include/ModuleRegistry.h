@@ -0,0 +1,79 @@
+#ifndef MODULEREGISTRY_H
+#define MODULEREGISTRY_H
+
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "IDiscoveryService.h"
+#include "mDNSRobotModule.h"
+
+struct ModuleChange {
+    ModuleEvent event;
+    mDNSRobotModule module;
+};
+
+// A PTR record we already hold, listed in a query so its owner does not answer again.
+struct KnownAnswer {
+    std::string instance;
+    std::chrono::seconds ttl; // remaining TTL of the PTR record
+};
+
+// Tracks discovered modules with the TTL of their records. A module expires once its TTL has
+// run out, or earlier if it stopped answering queries it should have answered (RFC 6762 10.5).
+//
+// Records are queried for again at 80, 85, 90 and 95% of their TTL, plus up to 2% at random
+// (RFC 6762 5.2), so a single lost response does not let a live module expire.
+class ModuleRegistry {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    // ttl is the shortest TTL of the module's A and TXT records, ptr_ttl that of its PTR record
+    // if the response carried one.
+    std::optional<ModuleChange> update(const mDNSRobotModule &module, std::chrono::seconds ttl,
+                                       std::string_view instance = {},
+                                       std::optional<std::chrono::seconds> ptr_ttl = std::nullopt,
+                                       Clock::time_point now = Clock::now());
+    std::optional<mDNSRobotModule> remove(uint8_t id);
+    std::vector<mDNSRobotModule> expire(Clock::time_point now = Clock::now());
+
+    // Records that a query is being sent and returns the known answers to list in it. Modules
+    // listed are expected to stay quiet, so only the others count the query as unanswered.
+    // Modules due for a refresh are never listed, the query is meant for them.
+    std::vector<KnownAnswer> record_query(Clock::time_point now = Clock::now());
+    // When the next refresh query is due, nullopt if no record needs one.
+    std::optional<Clock::time_point> next_refresh() const;
+    // The shortest TTL of any module's records, nullopt while there are none.
+    std::optional<std::chrono::seconds> shortest_ttl() const;
+
+    std::unordered_map<uint8_t, mDNSRobotModule> modules() const;
+    std::unordered_set<uint8_t> ids() const;
+
+  private:
+    struct Entry {
+        mDNSRobotModule module;
+        std::chrono::seconds ttl;
+        Clock::time_point last_seen;
+        std::string instance;
+        std::chrono::seconds ptr_ttl{0};
+        Clock::time_point ptr_seen;
+        int unanswered_queries = 0;
+        size_t refreshes = 0;       // refresh queries sent since last seen
+        double refresh_jitter = 0;  // fraction of the TTL added to every refresh point
+    };
+
+    static std::optional<Clock::time_point> refresh_time(const Entry &entry);
+    double random_jitter();
+
+    std::unordered_map<uint8_t, Entry> m_entries;
+    std::minstd_rand m_random{std::random_device{}()};
+    mutable std::mutex m_mutex;
+};
+
+#endif // MODULEREGISTRY_H
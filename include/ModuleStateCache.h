@@ -0,0 +1,43 @@
+#ifndef MODULESTATECACHE_H
+#define MODULESTATECACHE_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+#include "flatbuffers_generated/RobotModule_generated.h"
+
+struct ModuleStateSnapshot {
+    uint8_t id;
+    ModuleType module_type;
+    ModuleState configuration_type;
+    int32_t angle;    // MotorState.angle, 0 unless configuration_type is ModuleState_MotorState
+    uint64_t version; // counts updates, readers can tell whether anything changed
+    std::chrono::steady_clock::time_point received;
+};
+
+// The latest RobotModule state of every module, indexed by id. Each slot is a seqlock: a single
+// writer (the dispatcher) bumps the sequence around its update and readers retry if it moved
+// underneath them, so readers never block, never allocate and never hold up the writer.
+class ModuleStateCache {
+  public:
+    void update(const RobotModule &module, std::chrono::steady_clock::time_point received);
+    std::optional<ModuleStateSnapshot> get(uint8_t id) const;
+
+  private:
+    // Every field is atomic so torn reads are well defined, the sequence says whether to trust
+    // them.
+    struct Slot {
+        std::atomic<uint64_t> sequence = 0; // odd while an update is in progress
+        std::atomic<int8_t> module_type = 0;
+        std::atomic<uint8_t> configuration_type = 0;
+        std::atomic<int32_t> angle = 0;
+        std::atomic<int64_t> received = 0;
+    };
+
+    std::array<Slot, 256> m_slots;
+};
+
+#endif // MODULESTATECACHE_H
@@ -0,0 +1,111 @@
+#ifndef NACKCHANNEL_H
+#define NACKCHANNEL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+constexpr auto NACK_BUFFER_SIZE = 128;   // sent messages kept for retransmission per module
+constexpr auto NACK_MAX_MISSING = 64;    // gaps followed per sender, older ones are given up
+constexpr auto NACK_MAX_ATTEMPTS = 5;    // NACKs sent for one gap before giving up
+constexpr auto NACK_MAX_RETRANSMITS = 5; // retransmissions of one message
+
+struct NackStats {
+    uint64_t retransmitted = 0; // messages we sent again on request
+    uint64_t expired = 0;       // requested after their deadline, not sent again
+    uint64_t evicted = 0;       // pushed out of a full buffer before their deadline
+    uint64_t nacks_sent = 0;
+    uint64_t recovered = 0;     // gaps in what we received that were filled
+    uint64_t unrecovered = 0;   // gaps given up on
+};
+
+// Selective reliability over a lossy transport. Messages are numbered per destination and kept
+// until their deadline. The receiver NACKs the numbers it is missing and the sender sends those
+// again, as long as their deadline has not passed. Nothing is ever waited for, so unlike TCP a
+// lost message does not hold up the ones behind it.
+//
+// A MessageType_NACK message carries the newest number its sender has sent to the destination
+// in sequence_number, and the numbers it is missing from the destination as uint16_t in the
+// payload. With nothing missing it only announces the newest number, which is how a receiver
+// learns that the last message of a burst was lost.
+//
+// Numbers start over when the sender restarts, which the receiver learns from the session id
+// carried by every message, NACKs included.
+class NackChannel {
+  public:
+    using Clock = std::chrono::steady_clock;
+    using ResendFunction = std::function<void(uint8_t module, std::vector<uint8_t> &frame)>;
+    using NackFunction = std::function<void(uint8_t module, uint16_t newest_sent,
+                                            const std::vector<uint16_t> &missing)>;
+    using RetryInterval = std::function<std::chrono::microseconds(uint8_t module)>;
+
+    NackChannel(ResendFunction resend, NackFunction send_nack, RetryInterval retry_interval);
+    ~NackChannel();
+
+    // Sending side.
+    uint16_t next_sequence(uint8_t destination);
+    void sent(uint8_t destination, uint16_t sequence, const uint8_t *frame, size_t size,
+              Clock::time_point deadline);
+
+    // Receiving side. False for a message already received, or given up on, which is dropped.
+    bool received(uint8_t sender, uint16_t sequence, uint32_t session);
+    void on_nack(uint8_t sender, uint16_t newest_sent, const std::vector<uint16_t> &missing,
+                 uint32_t session);
+    // Forgets what was received from sender, for a sender that went away.
+    void reset(uint8_t sender);
+
+    NackStats stats(uint8_t module);
+
+  private:
+    struct Sent {
+        uint16_t sequence;
+        std::vector<uint8_t> frame;
+        Clock::time_point deadline;
+        int retransmits = 0;
+    };
+
+    struct Outgoing {
+        uint16_t next = 0;
+        uint16_t newest = 0;    // newest number actually sent
+        uint16_t announced = 0; // newest number a NACK message told the destination about
+        std::deque<Sent> sent;
+        Clock::time_point last_sent;
+    };
+
+    struct Missing {
+        Clock::time_point last_nack;
+        int attempts = 0;
+    };
+
+    struct Incoming {
+        bool started = false;
+        uint32_t session = 0;
+        uint16_t newest = 0;
+        std::map<uint16_t, Missing> missing;
+    };
+
+    std::vector<uint16_t> add_gaps(Incoming &incoming, NackStats &stats, uint16_t end,
+                                   Clock::time_point now);
+    void retry_thread();
+
+    ResendFunction m_resend;
+    NackFunction m_send_nack;
+    RetryInterval m_retry_interval;
+    std::unordered_map<uint8_t, Outgoing> m_outgoing;
+    std::unordered_map<uint8_t, Incoming> m_incoming;
+    std::unordered_map<uint8_t, NackStats> m_stats;
+    std::atomic<bool> m_stop_flag;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+#endif // NACKCHANNEL_H
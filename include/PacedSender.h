@@ -0,0 +1,109 @@
+#ifndef PACEDSENDER_H
+#define PACEDSENDER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "ICommunicationClient.h"
+#include "MessagePriority.h"
+
+constexpr auto PACING_QUEUE_SIZE = 256; // messages waiting per link before sends are rejected
+
+// Rate limits for the link to a module. A zero rate leaves that dimension unlimited.
+struct PacingLimits {
+    double bytes_per_second = 0;
+    double messages_per_second = 0;
+    double burst_bytes = 0;      // bucket depth, sends can go out back to back up to this
+    double burst_messages = 1;
+};
+
+struct PacingStats {
+    uint64_t sent = 0;
+    uint64_t rejected = 0; // the link's queue was full
+    size_t queued = 0;
+};
+
+// Two token buckets filled at once, one in bytes and one in messages. A message larger than the
+// bucket is let through once the bucket is full and leaves it in debt, so limits smaller than
+// a message slow it down rather than stall it.
+class TokenBucket {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    void set_limits(const PacingLimits &limits, Clock::time_point now);
+    // How long until a message of size may go out, zero if it may go now.
+    Clock::duration wait_time(size_t size, Clock::time_point now);
+    void consume(size_t size);
+
+  private:
+    void refill(Clock::time_point now);
+
+    PacingLimits m_limits;
+    double m_bytes = 0;
+    double m_messages = 0;
+    Clock::time_point m_last_refill;
+};
+
+// Spaces out the messages sent over each paced link to fit its limits. Callers hand messages
+// over and return straight away, each link has its own thread which sends them as tokens allow
+// and completes the optional promise with the result, so a TCP send stalled on one module does
+// not hold up the others. A module overrun by a burst drops datagrams or stalls TCP until
+// SO_SNDTIMEO, pacing keeps sends under what it can take instead. Links without limits are
+// submitted with a default PacingLimits, which only gives them their own sender.
+class PacedSender {
+  public:
+    PacedSender();
+    ~PacedSender();
+
+    // Queues frame for client, the link to module link. Messages on a link go out in order,
+    // except Critical ones which go ahead of anything queued below them. Returns false, and
+    // completes the promise with -1, if the link already has PACING_QUEUE_SIZE messages waiting.
+    bool submit(uint8_t link, const PacingLimits &limits,
+                std::shared_ptr<ICommunicationClient> client, std::vector<uint8_t> frame,
+                MessagePriority priority, std::optional<std::promise<int>> completion);
+    // Forgets the link, failing whatever it still had queued. Waits for a send in progress on
+    // the link to finish.
+    void remove(uint8_t link);
+    PacingStats stats(uint8_t link);
+    // True while the link has messages queued or one being written. A caller sending on the link
+    // itself must queue behind them to keep its messages in order.
+    bool busy(uint8_t link);
+
+  private:
+    using Clock = TokenBucket::Clock;
+
+    struct Pending {
+        std::shared_ptr<ICommunicationClient> client;
+        std::vector<uint8_t> frame;
+        MessagePriority priority;
+        std::optional<std::promise<int>> completion;
+    };
+
+    struct Link {
+        TokenBucket bucket;
+        std::deque<Pending> queue;
+        PacingStats stats;
+        bool sending = false;
+        bool stop = false;
+        std::condition_variable cond;
+        std::thread thread;
+    };
+
+    void send_thread(Link &link);
+    void stop(std::unique_ptr<Link> link);
+    static void fail(std::deque<Pending> &pending);
+
+    std::unordered_map<uint8_t, std::unique_ptr<Link>> m_links;
+    std::mutex m_mutex;
+};
+
+#endif // PACEDSENDER_H
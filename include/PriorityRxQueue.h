@@ -0,0 +1,41 @@
+#ifndef PRIORITYRXQUEUE_H
+#define PRIORITYRXQUEUE_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "BlockingQueue.h"
+#include "MessagePriority.h"
+
+// The queue connections hand received messages to, split into one lane per priority class.
+// Dequeueing always takes from the highest class that has anything, so a burst of bulk traffic
+// delays a critical message by at most the message being dispatched, and a full bulk lane never
+// blocks the socket readers from queueing critical ones. Messages are verified as they are
+// queued, anything dequeued is a valid MPIMessage.
+class PriorityRxQueue {
+  public:
+    explicit PriorityRxQueue(size_t lane_capacity);
+
+    // Same contract as BlockingQueue::enqueue, in the lane of the message's priority. A message
+    // that is not a valid MPIMessage is dropped, and counts as taken.
+    bool enqueue(std::unique_ptr<std::vector<uint8_t>> &&message,
+                 std::chrono::milliseconds max_wait);
+    std::optional<std::unique_ptr<std::vector<uint8_t>>>
+    dequeue(std::chrono::milliseconds max_wait);
+    QueueStats stats(MessagePriority priority);
+
+  private:
+    std::array<std::unique_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>>,
+               PRIORITY_CLASSES>
+        m_lanes;
+    size_t m_available = 0; // queued and not yet claimed by a dequeue
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+#endif // PRIORITYRXQUEUE_H
@@ -0,0 +1,79 @@
+#ifndef REPLAYBUFFER_H
+#define REPLAYBUFFER_H
+
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+constexpr auto REPLAY_BUFFER_SIZE = 128; // unacknowledged durable messages kept per module
+constexpr auto SEQUENCE_WINDOW = 256;    // how far back a durable message counts as a duplicate
+
+// Durable messages carry a per-destination sequence number starting at 1, 0 meaning none, and
+// every message carries the cumulative ack of the durable messages received from its
+// destination. After a reconnect the sender replays what has not been acknowledged, and the
+// receiver drops what it has already seen. Numbering starts over when the sender restarts,
+// which receivers learn from the session id every message carries.
+
+// Wrap-around comparison, a is before b.
+inline bool sequence_before(const uint16_t a, const uint16_t b) {
+    return static_cast<int16_t>(a - b) < 0;
+}
+
+// Receiver side de-duplication for one sender. Tolerates reordering within SEQUENCE_WINDOW,
+// anything further back counts as already received. The window starts over with a new session
+// of the sender, or after reset. Senders without sessions send 0 throughout.
+class SequenceWindow {
+  public:
+    // False for a message already received. Only called by the dispatcher.
+    bool accept(uint16_t sequence, uint32_t session);
+    // Starts over with the next message, for a sender that went away. Safe from any thread.
+    void reset();
+    // The highest sequence number up to which everything has been received, 0 for none.
+    uint16_t cumulative() const {
+        return m_cumulative.load(std::memory_order_relaxed);
+    }
+
+  private:
+    uint16_t m_base = 0; // first sequence number not yet received in order
+    std::bitset<SEQUENCE_WINDOW> m_received; // bit i is m_base + i
+    bool m_started = false;
+    uint32_t m_session = 0;
+    std::atomic<bool> m_reset = false;
+    std::atomic<uint16_t> m_cumulative = 0;
+};
+
+// Sender side copies of durable messages until their destination acknowledges them, so a new
+// connection can pick up where the old one left off. Only modules that have acknowledged
+// something are tracked, firmware without acks would take replays as new messages.
+class ReplayBuffer {
+  public:
+    void record(uint8_t module, uint16_t sequence, const uint8_t *frame, size_t size);
+    void acknowledge(uint8_t module, uint16_t ack);
+    void remove(uint8_t module);
+    // Frames not yet acknowledged by modules matching filter, oldest first for each module.
+    std::vector<std::vector<uint8_t>>
+    unacknowledged(const std::function<bool(uint8_t)> &filter);
+    // Messages dropped unacknowledged because the module's buffer was full.
+    uint64_t overflowed(uint8_t module);
+
+  private:
+    struct Entry {
+        uint16_t sequence;
+        std::vector<uint8_t> frame;
+    };
+
+    struct Module {
+        std::deque<Entry> unacknowledged;
+        uint64_t overflowed = 0;
+    };
+
+    std::unordered_map<uint8_t, Module> m_modules;
+    std::mutex m_mutex;
+};
+
+#endif // REPLAYBUFFER_H
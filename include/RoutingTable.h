@@ -0,0 +1,40 @@
+#ifndef ROUTINGTABLE_H
+#define ROUTINGTABLE_H
+
+#include <array>
+#include <chrono>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "mDNSRobotModule.h"
+
+// Picks the directly connected module to send through for every destination, from the
+// topology modules advertise in connected_module_ids. Routes take the fewest hops, ties go to
+// the first hop with the lowest measured RTT. Lookups are a single array read.
+class RoutingTable {
+  public:
+    RoutingTable();
+
+    void update_module(const mDNSRobotModule &module);
+    void remove_module(uint8_t id);
+    void set_link_rtt(uint8_t id, std::chrono::microseconds rtt);
+
+    std::optional<uint8_t> next_hop(uint8_t destination) const;
+    std::unordered_set<uint8_t> reachable_modules() const;
+
+  private:
+    void recompute();
+
+    static constexpr int NO_ROUTE = -1;
+
+    // Modules we have a connection to, and the undirected links advertised between modules.
+    std::unordered_set<uint8_t> m_direct;
+    std::unordered_map<uint8_t, std::unordered_set<uint8_t>> m_advertised;
+    std::unordered_map<uint8_t, std::chrono::microseconds> m_rtt;
+    std::array<int, 256> m_next_hop{};
+    mutable std::shared_mutex m_mutex;
+};
+
+#endif // ROUTINGTABLE_H
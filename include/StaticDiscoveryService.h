@@ -0,0 +1,34 @@
+#ifndef STATICDISCOVERYSERVICE_H
+#define STATICDISCOVERYSERVICE_H
+
+#include <filesystem>
+#include <unordered_map>
+#include <vector>
+
+#include "IDiscoveryService.h"
+#include "mDNSRobotModule.h"
+
+// Serves a fixed set of modules, for deployments with known addresses. Nothing is sent on the
+// network to find them, so find_modules returns immediately.
+class StaticDiscoveryService final : public IDiscoveryService {
+
+  public:
+    explicit StaticDiscoveryService(const std::vector<mDNSRobotModule> &modules);
+    // Reads modules from a file in the DiscoveryCache format.
+    explicit StaticDiscoveryService(const std::filesystem::path &path);
+    ~StaticDiscoveryService() override = default;
+    std::unordered_set<uint8_t> find_modules(std::chrono::duration<double> wait_time) override;
+    std::unordered_map<uint8_t, mDNSRobotModule> get_modules() override;
+    void add_module_callback(ModuleEventCallback callback) override;
+    std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> get_lossy_clients(
+        const std::shared_ptr<PriorityRxQueue> &rx_queue,
+        std::vector<uint8_t> &skip_modules) override;
+    std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> get_lossless_clients(
+        const std::shared_ptr<PriorityRxQueue> &rx_queue,
+        std::vector<uint8_t> &skip_modules) override;
+
+  private:
+    std::unordered_map<uint8_t, mDNSRobotModule> m_modules;
+};
+
+#endif // STATICDISCOVERYSERVICE_H
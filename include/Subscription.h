@@ -0,0 +1,39 @@
+#ifndef SUBSCRIPTION_H
+#define SUBSCRIPTION_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// A callback subscribed to a tag. Without an executor the callback runs inline on the
+// dispatcher thread. With one, deliveries are posted to it but still reach the callback one at
+// a time and in arrival order, even if the executor runs tasks on several threads.
+class Subscription : public std::enable_shared_from_this<Subscription> {
+  public:
+    using Callback = std::function<void(std::span<const uint8_t> payload, uint8_t sender)>;
+    using Executor = std::function<void(std::function<void()>)>;
+
+    Subscription(Callback callback, Executor executor);
+
+    void deliver(std::vector<uint8_t> payload, uint8_t sender);
+
+  private:
+    struct Message {
+        std::vector<uint8_t> payload;
+        uint8_t sender;
+    };
+
+    void drain();
+
+    Callback m_callback;
+    Executor m_executor;
+    std::deque<Message> m_pending;
+    bool m_draining = false;
+    std::mutex m_mutex;
+};
+
+#endif // SUBSCRIPTION_H
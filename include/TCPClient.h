@@ -4,6 +4,8 @@
 
 #ifndef TCPCLIENT_H
 #define TCPCLIENT_H
+#include <atomic>
+#include <mutex>
 #include <thread>
 #include <utility>
 
@@ -24,31 +26,43 @@ typedef SOCKET socket_t;
 typedef int socket_t;
 #endif
 
-#include "BlockingQueue.h"
+#include "PriorityRxQueue.h"
 
 class TCPClient final : public ICommunicationClient {
 
   public:
     TCPClient(std::string ip,
-              const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue)
+              const std::shared_ptr<PriorityRxQueue> &rx_queue)
         : port{3001}, m_ip{std::move(ip)}, m_stop_flag(false),
           m_thread(std::thread(&TCPClient::rx_thread, this)), m_rx_queue(rx_queue) {
     }
     ~TCPClient() override;
     int init() override;
+    using ICommunicationClient::send_msg;
     int send_msg(void *sendbuff, uint32_t len) override;
+    void set_replay_source(ReplaySource source) override;
+    void drop_connection() override;
 
   private:
     void deinit();
-    void rx_thread() const;
+    void rx_thread();
+    socket_t open_socket() const;
+    bool connect_socket(socket_t sock) const;
+    int write_frame(const void *buffer, uint32_t len) const;
+    void connection_lost();
+    void reconnect();
 
     socket_t m_socket = -1;
     int port;
-    bool m_initialized = false;
+    sockaddr_in m_address{};
+    std::atomic<bool> m_initialized = false;
+    std::atomic<bool> m_init_done = false; // init has run, from then on the rx thread reconnects
     std::string m_ip;
+    ReplaySource m_replay_source;
+    std::mutex m_send_mutex; // keeps length and frame together, guards m_socket and the source
     std::atomic<bool> m_stop_flag;
     std::thread m_thread;
-    std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> m_rx_queue;
+    std::shared_ptr<PriorityRxQueue> m_rx_queue;
 };
 
 #endif // TCPCLIENT_H
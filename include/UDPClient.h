@@ -24,30 +24,32 @@ typedef SOCKET socket_t;
 typedef int socket_t;
 #endif
 
-#include "BlockingQueue.h"
+#include "PriorityRxQueue.h"
 
 class UDPClient final : public ICommunicationClient {
 
   public:
     UDPClient(std::string /* ip */,
-              const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue)
+              const std::shared_ptr<PriorityRxQueue> &rx_queue)
         : m_stop_flag(false), m_thread(std::thread(&UDPClient::rx_thread, this)),
           m_rx_queue(rx_queue) {
     }
     ~UDPClient() override;
     int init() override;
     int send_msg(void *sendbuff, uint32_t len) override;
+    int send_msg(void *sendbuff, uint32_t len, MessagePriority priority) override;
 
   private:
     void deinit();
     void rx_thread() const;
 
     socket_t m_tx_socket = -1;
+    socket_t m_critical_tx_socket = -1;
     socket_t m_rx_socket = -1;
     bool m_initialized = false;
     std::atomic<bool> m_stop_flag;
     std::thread m_thread;
-    std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> m_rx_queue;
+    std::shared_ptr<PriorityRxQueue> m_rx_queue;
 };
 
 #endif // UDPCLIENT_H
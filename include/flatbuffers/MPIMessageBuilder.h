@@ -5,6 +5,7 @@
 #ifndef MPIMESSAGEBUILDER_H
 #define MPIMESSAGEBUILDER_H
 
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -13,18 +14,39 @@
 #include "flatbuffers/flatbuffers.h"
 
 namespace Flatbuffers {
+
+// Bits of the MPIMessage flags field. Bits 1-2 hold the MessagePriority.
+constexpr uint8_t MPI_FLAG_COMPRESSED = 1 << 0;
+constexpr uint8_t MPI_FLAG_RELIABLE = 1 << 3; // lossy transport, repaired by NACKs
+
 class MPIMessageBuilder {
   public:
     MPIMessageBuilder() : builder_(1024) {
     }
 
+    // ack is the cumulative ack of durable messages received from destination, see
+    // ReplayBuffer.h. Every message is stamped with session().
     SerializedMessage build_mpi_message(Messaging::MessageType type, uint8_t sender,
                                         uint8_t destination, uint16_t sequence_number,
                                         bool is_durable, uint8_t tag,
-                                        const std::vector<uint8_t> &payload);
+                                        const std::vector<uint8_t> &payload, uint8_t flags = 0,
+                                        uint16_t ack = 0);
 
     static const Messaging::MPIMessage *parse_mpi_message(const uint8_t *buffer);
 
+    // Random id of this run of the process, never 0. Sequence numbers start over with every
+    // run, receivers tell the runs apart by it rather than guessing from the numbers.
+    static uint32_t session();
+
+    // Copies the payload into buffer, decompressing it if needed. Returns the number of bytes
+    // written (truncated to size), or nullopt if the payload could not be decoded.
+    static std::optional<size_t> read_payload(const Messaging::MPIMessage *message,
+                                              uint8_t *buffer, size_t size);
+
+    // Returns the whole payload, decompressed if needed.
+    static std::optional<std::vector<uint8_t>>
+    read_payload(const Messaging::MPIMessage *message);
+
   private:
     flatbuffers::FlatBufferBuilder builder_;
 };
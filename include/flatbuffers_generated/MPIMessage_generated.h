@@ -20,22 +20,25 @@ struct MPIMessageBuilder;
 enum MessageType : int8_t {
     MessageType_BROADCAST = 0,
     MessageType_PTP = 1,
+    MessageType_AGGREGATE = 2,
+    MessageType_NACK = 3,
     MessageType_MIN = MessageType_BROADCAST,
-    MessageType_MAX = MessageType_PTP
+    MessageType_MAX = MessageType_NACK
 };
 
-inline const MessageType (&EnumValuesMessageType())[2] {
-    static const MessageType values[] = {MessageType_BROADCAST, MessageType_PTP};
+inline const MessageType (&EnumValuesMessageType())[4] {
+    static const MessageType values[] = {MessageType_BROADCAST, MessageType_PTP,
+                                         MessageType_AGGREGATE, MessageType_NACK};
     return values;
 }
 
 inline const char *const *EnumNamesMessageType() {
-    static const char *const names[3] = {"BROADCAST", "PTP", nullptr};
+    static const char *const names[5] = {"BROADCAST", "PTP", "AGGREGATE", "NACK", nullptr};
     return names;
 }
 
 inline const char *EnumNameMessageType(MessageType e) {
-    if (::flatbuffers::IsOutRange(e, MessageType_BROADCAST, MessageType_PTP))
+    if (::flatbuffers::IsOutRange(e, MessageType_BROADCAST, MessageType_NACK))
         return "";
     const size_t index = static_cast<size_t>(e);
     return EnumNamesMessageType()[index];
@@ -51,7 +54,11 @@ struct MPIMessage FLATBUFFERS_FINAL_CLASS : private ::flatbuffers::Table {
         VT_IS_DURABLE = 12,
         VT_LENGTH = 14,
         VT_TAG = 16,
-        VT_PAYLOAD = 18
+        VT_PAYLOAD = 18,
+        VT_FLAGS = 20,
+        VT_CREDITS = 22,
+        VT_ACK = 24,
+        VT_SESSION = 26
     };
     Messaging::MessageType type() const {
         return static_cast<Messaging::MessageType>(GetField<int8_t>(VT_TYPE, 0));
@@ -77,6 +84,18 @@ struct MPIMessage FLATBUFFERS_FINAL_CLASS : private ::flatbuffers::Table {
     const ::flatbuffers::Vector<uint8_t> *payload() const {
         return GetPointer<const ::flatbuffers::Vector<uint8_t> *>(VT_PAYLOAD);
     }
+    uint8_t flags() const {
+        return GetField<uint8_t>(VT_FLAGS, 0);
+    }
+    uint8_t credits() const {
+        return GetField<uint8_t>(VT_CREDITS, 0);
+    }
+    uint16_t ack() const {
+        return GetField<uint16_t>(VT_ACK, 0);
+    }
+    uint32_t session() const {
+        return GetField<uint32_t>(VT_SESSION, 0);
+    }
     bool Verify(::flatbuffers::Verifier &verifier) const {
         return VerifyTableStart(verifier) && VerifyField<int8_t>(verifier, VT_TYPE, 1) &&
                VerifyField<uint8_t>(verifier, VT_SENDER, 1) &&
@@ -85,7 +104,10 @@ struct MPIMessage FLATBUFFERS_FINAL_CLASS : private ::flatbuffers::Table {
                VerifyField<uint8_t>(verifier, VT_IS_DURABLE, 1) &&
                VerifyField<uint16_t>(verifier, VT_LENGTH, 2) &&
                VerifyField<uint8_t>(verifier, VT_TAG, 1) && VerifyOffset(verifier, VT_PAYLOAD) &&
-               verifier.VerifyVector(payload()) && verifier.EndTable();
+               verifier.VerifyVector(payload()) && VerifyField<uint8_t>(verifier, VT_FLAGS, 1) &&
+               VerifyField<uint8_t>(verifier, VT_CREDITS, 1) &&
+               VerifyField<uint16_t>(verifier, VT_ACK, 2) &&
+               VerifyField<uint32_t>(verifier, VT_SESSION, 4) && verifier.EndTable();
     }
 };
 
@@ -117,6 +139,18 @@ struct MPIMessageBuilder {
     void add_payload(::flatbuffers::Offset<::flatbuffers::Vector<uint8_t>> payload) {
         fbb_.AddOffset(MPIMessage::VT_PAYLOAD, payload);
     }
+    void add_flags(uint8_t flags) {
+        fbb_.AddElement<uint8_t>(MPIMessage::VT_FLAGS, flags, 0);
+    }
+    void add_credits(uint8_t credits) {
+        fbb_.AddElement<uint8_t>(MPIMessage::VT_CREDITS, credits, 0);
+    }
+    void add_ack(uint16_t ack) {
+        fbb_.AddElement<uint16_t>(MPIMessage::VT_ACK, ack, 0);
+    }
+    void add_session(uint32_t session) {
+        fbb_.AddElement<uint32_t>(MPIMessage::VT_SESSION, session, 0);
+    }
     explicit MPIMessageBuilder(::flatbuffers::FlatBufferBuilder &_fbb) : fbb_(_fbb) {
         start_ = fbb_.StartTable();
     }
@@ -132,11 +166,16 @@ CreateMPIMessage(::flatbuffers::FlatBufferBuilder &_fbb,
                  Messaging::MessageType type = Messaging::MessageType_BROADCAST, uint8_t sender = 0,
                  uint8_t destination = 0, uint16_t sequence_number = 0, bool is_durable = false,
                  uint16_t length = 0, uint8_t tag = 0,
-                 ::flatbuffers::Offset<::flatbuffers::Vector<uint8_t>> payload = 0) {
+                 ::flatbuffers::Offset<::flatbuffers::Vector<uint8_t>> payload = 0,
+                 uint8_t flags = 0, uint8_t credits = 0, uint16_t ack = 0, uint32_t session = 0) {
     MPIMessageBuilder builder_(_fbb);
+    builder_.add_session(session);
     builder_.add_payload(payload);
+    builder_.add_ack(ack);
     builder_.add_length(length);
     builder_.add_sequence_number(sequence_number);
+    builder_.add_credits(credits);
+    builder_.add_flags(flags);
     builder_.add_tag(tag);
     builder_.add_is_durable(is_durable);
     builder_.add_destination(destination);
@@ -150,10 +189,11 @@ CreateMPIMessageDirect(::flatbuffers::FlatBufferBuilder &_fbb,
                        Messaging::MessageType type = Messaging::MessageType_BROADCAST,
                        uint8_t sender = 0, uint8_t destination = 0, uint16_t sequence_number = 0,
                        bool is_durable = false, uint16_t length = 0, uint8_t tag = 0,
-                       const std::vector<uint8_t> *payload = nullptr) {
+                       const std::vector<uint8_t> *payload = nullptr, uint8_t flags = 0,
+                       uint8_t credits = 0, uint16_t ack = 0, uint32_t session = 0) {
     auto payload__ = payload ? _fbb.CreateVector<uint8_t>(*payload) : 0;
     return Messaging::CreateMPIMessage(_fbb, type, sender, destination, sequence_number, is_durable,
-                                       length, tag, payload__);
+                                       length, tag, payload__, flags, credits, ack, session);
 }
 
 inline const Messaging::MPIMessage *GetMPIMessage(const void *buf) {
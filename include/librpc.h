@@ -1,76 +1,370 @@
 #ifndef RPC_LIBRARY_H
 #define RPC_LIBRARY_H
 
+#include <array>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <future>
 #include <memory>
+#include <optional>
 #include <semaphore>
 #include <shared_mutex>
 #include <thread>
+#include <type_traits>
 
 #include "BlockingQueue.h"
+#include "CompletionTracker.h"
+#include "ConflatingSender.h"
+#include "CreditGate.h"
+#include "LinkMonitor.h"
+#include "LossTracker.h"
+#include "MessageAggregator.h"
+#include "MessagePriority.h"
+#include "ModuleStateCache.h"
+#include "NackChannel.h"
+#include "PacedSender.h"
+#include "PriorityRxQueue.h"
+#include "ReplayBuffer.h"
+#include "RoutingTable.h"
+#include "Subscription.h"
 #include "constants.h"
 #include "flatbuffers/CallBuilder.h"
+#include "StaticDiscoveryService.h"
 #include "mDNSDiscoveryService.h"
 
 constexpr auto RX_QUEUE_SIZE = 100;
-constexpr auto FN_CALL_TAG = 100; // reserved tag for RPC functionality
+constexpr auto FN_CALL_TAG = 100;   // reserved tag for RPC functionality
+constexpr auto HEARTBEAT_TAG = 101; // reserved tag for heartbeats
 constexpr auto FN_CALL_TIMEOUT = std::chrono::seconds(10);
+constexpr auto HEARTBEAT_INTERVAL = std::chrono::seconds(1);
+constexpr auto COLLECTIVE_TIMEOUT = std::chrono::milliseconds(3000);
+constexpr int ANY_SOURCE = -1; // recv_from wildcard
+constexpr auto MODULE_EVENT_ENQUEUE_TIMEOUT = std::chrono::milliseconds(250);
 
 struct SizeAndSource {
     size_t bytes_written;
     uint8_t sender;
 };
 
+struct RecvKey {
+    uint8_t tag;
+    int source = ANY_SOURCE;
+};
+
+using SubscriptionId = uint64_t;
+
+struct RecvAnyResult {
+    size_t key_index; // which of the keys the message matched
+    SizeAndSource received;
+};
+
 class MessagingInterface {
   public:
-    MessagingInterface()
-        : m_stop_flag(false), m_rx_thread(std::thread(&MessagingInterface::handle_recv, this)),
-          m_fn_rx_thread(std::thread(&MessagingInterface::handle_fn_recv, this)),
-          m_rx_queue(std::make_shared<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>>(
-              RX_QUEUE_SIZE)) {
-#ifdef _WIN32
-        WSADATA wsaData;
-        WSAStartup(MAKEWORD(2, 2), &wsaData);
-#endif
-        // Initialization must be after call to WSAStartup
-        m_discovery_service = std::make_unique<mDNSDiscoveryService>();
+    // discovery_cache optionally names a file used to remember modules across restarts, so
+    // connections can be made before the first scan completes.
+    explicit MessagingInterface(std::optional<std::filesystem::path> discovery_cache = std::nullopt)
+        : MessagingInterface(nullptr, std::move(discovery_cache)) {
+    }
+
+    // Uses the given discovery service instead of mDNS, for example a StaticDiscoveryService.
+    explicit MessagingInterface(std::unique_ptr<IDiscoveryService> discovery_service)
+        : MessagingInterface(std::move(discovery_service), std::nullopt) {
     }
 
     ~MessagingInterface();
+    // Returns 0 once the message is sent or queued, -1 if it could not be. A durable message is
+    // kept for replay as soon as it is accepted, so it returns 0 even if writing it fails: it
+    // goes out again when the connection is back, and must not be resent. -1 for a durable
+    // message means it was never accepted, no connection to destination or no credits left.
     int send(uint8_t *buffer, size_t size, uint8_t destination, uint8_t tag, bool durable);
-    int broadcast(uint8_t *buffer, size_t size, bool durable); // todo
+    // Sends over UDP, but retransmits the message when destination reports it missing, until
+    // deadline has passed. Unlike a durable send nothing waits for a lost message, so later
+    // messages are never held up behind it. Duplicates are dropped on the receiving side.
+    int send(uint8_t *buffer, size_t size, uint8_t destination, uint8_t tag,
+             std::chrono::milliseconds deadline);
+    // Like send, but returns without waiting for the write, which the link's sender does. The
+    // future completes with 0 or -1 once the message has been written out, for paced modules
+    // once their turn has come. With aggregation enabled, a
+    // message packed into a frame completes as soon as it is packed, before the frame is sent.
+    // A durable message whose write fails completes with -1 but is still replayed, like for send
+    // it must not be resent.
+    std::future<int> send_async(uint8_t *buffer, size_t size, uint8_t destination, uint8_t tag,
+                                bool durable);
+    // Sends from a background thread per destination, keeping only the most recent unsent
+    // payload for each destination, tag and durability. Meant for setpoint streams where a
+    // stale value is worthless; the receiving side of this is
+    // set_overflow_policy(tag, OverflowPolicy::Conflate).
+    int send_latest(uint8_t *buffer, size_t size, uint8_t destination, uint8_t tag, bool durable);
+    // Number of send_latest payloads replaced before they were sent.
+    uint64_t conflated_sends() const;
+    // Sends to every module. Lossy broadcasts are a single multicast datagram. Durable ones are
+    // written to every TCP connection in parallel, each copy numbered, flow controlled and
+    // replayed like a durable send to the module at the other end.
+    int broadcast(uint8_t *buffer, size_t size, uint8_t tag, bool durable);
     std::optional<SizeAndSource> recv(uint8_t *buffer, size_t size, uint8_t tag);
+    // Receives only messages from source on tag, or behaves like recv for ANY_SOURCE. Once
+    // called for a source and tag, messages from that source on that tag are kept for
+    // recv_from and no longer reach recv.
+    std::optional<SizeAndSource> recv_from(uint8_t *buffer, size_t size, int source, uint8_t tag);
+    // Waits on several (tag, source) keys at once and receives from whichever has a message
+    // first. Earlier keys win when several are ready. Returns nullopt on timeout.
+    std::optional<RecvAnyResult> recv_any(uint8_t *buffer, size_t size,
+                                          const std::vector<RecvKey> &keys,
+                                          std::chrono::milliseconds timeout);
+    // Sends durably to dest, then waits for the reply from dest on recv_tag. The reply is
+    // claimed before it reaches the tag queue, so recv callers on recv_tag never see it.
+    // Returns the number of bytes written to recv_buffer, or -1 on failure or timeout.
     int sendrecv(uint8_t *send_buffer, size_t send_size, uint8_t dest, uint8_t send_tag,
-                 uint8_t *recv_buffer, size_t recv_size,
-                 uint8_t recv_tag); // todo
+                 uint8_t *recv_buffer, size_t recv_size, uint8_t recv_tag);
+
+    // Delivers every message on tag to callback instead of the receive queues, straight from
+    // the dispatcher or through executor. Messages reach a subscription in the order they
+    // arrived. A reply a sendrecv or collective is waiting for is not delivered.
+    // An inline callback blocks the dispatcher, so it cannot wait for a reply: sendrecv, gather,
+    // reduce, barrier and remote_call fail straight away when called from one. Pass an executor
+    // to make such calls from a callback.
+    SubscriptionId subscribe(uint8_t tag, Subscription::Callback callback,
+                             Subscription::Executor executor = nullptr);
+    // Callbacks already running or posted to an executor may still complete afterwards.
+    void unsubscribe(SubscriptionId id);
+
+    // Treats messages on tag as RobotModule state reports. They update the state cache and go
+    // to subscribers of the tag, but are not queued for recv.
+    void set_state_tag(uint8_t tag);
+    // The latest state reported by module, without blocking or allocating. Safe to call from
+    // any number of threads at control rate.
+    std::optional<ModuleStateSnapshot> module_state(uint8_t module) const;
+
+    // What happens when the receive queues for tag are full. Block by default, which stalls
+    // the dispatcher for a while before dropping. Telemetry usually wants DropOldest or
+    // Conflate, which keeps the latest message from each sender.
+    void set_overflow_policy(uint8_t tag, OverflowPolicy policy);
+    QueueStats queue_stats(uint8_t tag);
+    // Stats of the lane of the queue every connection hands received messages to.
+    QueueStats rx_queue_stats(MessagePriority priority) const;
+
+    // Collectives across a set of distinct modules. Every message involved is tracked by a single
+    // CompletionTracker, so waiting on N modules costs one wait rather than N.
+
+    // Collects the next message on tag from each module. Modules that did not send one within
+    // the timeout are missing from the result. Listing a module twice is an error and returns
+    // nothing.
+    std::unordered_map<uint8_t, std::vector<uint8_t>>
+    gather(const std::vector<uint8_t> &modules, uint8_t tag,
+           std::chrono::milliseconds timeout = COLLECTIVE_TIMEOUT);
+
+    // Sends each module its own payload on tag. The sends are written concurrently, one per
+    // link, so a slow module does not hold up the rest.
+    int scatter(const std::unordered_map<uint8_t, std::vector<uint8_t>> &payloads, uint8_t tag,
+                bool durable);
+
+    // Gathers a T from each module on tag and folds them into init with op, in the order of
+    // modules. Returns nullopt if a module did not answer or sent something that is not a T.
+    template <typename T, typename BinaryOp>
+    std::optional<T> reduce(const std::vector<uint8_t> &modules, uint8_t tag, T init, BinaryOp op,
+                            std::chrono::milliseconds timeout = COLLECTIVE_TIMEOUT) {
+        static_assert(std::is_trivially_copyable_v<T>, "reduce needs a trivially copyable T");
+        auto payloads = gather(modules, tag, timeout);
+        for (const auto module : modules) {
+            const auto it = payloads.find(module);
+            if (it == payloads.end() || it->second.size() != sizeof(T)) {
+                return std::nullopt;
+            }
+            T value;
+            std::memcpy(&value, it->second.data(), sizeof(T));
+            init = op(init, value);
+        }
+        return init;
+    }
+
+    // Sends an empty message on tag to every module, then waits for each to answer on tag.
+    // Modules must be distinct.
+    int barrier(const std::vector<uint8_t> &modules, uint8_t tag,
+                std::chrono::milliseconds timeout = COLLECTIVE_TIMEOUT);
+
+    // Waits rpc_timeout(module, processing_budget) for the result. The budget defaults to
+    // FN_CALL_TIMEOUT, a caller that knows the function is quick can pass less.
     std::optional<std::unique_ptr<std::vector<uint8_t>>>
-    remote_call(uint8_t function_tag, uint8_t module, const std::vector<uint8_t> &parameters);
+    remote_call(uint8_t function_tag, uint8_t module, const std::vector<uint8_t> &parameters,
+                std::chrono::milliseconds processing_budget = FN_CALL_TIMEOUT);
     std::unordered_set<uint8_t> find_connected_modules(std::chrono::duration<double> scan_duration);
 
+    // Packs sends to the same connection into one frame, flushed when full or once the oldest
+    // message has waited max_delay.
+    void enable_aggregation(std::chrono::microseconds max_delay,
+                            size_t max_frame_size = AGGREGATE_MAX_FRAME_SIZE);
+    void disable_aggregation();
+    void flush();
+
+    // Compresses payloads sent on tag. Receivers decompress based on the message header, so
+    // this only needs enabling on the sending side. Only modules that advertise compression
+    // when discovered get compressed payloads, the others are sent the payload as is.
+    void set_compression(uint8_t tag, bool enabled);
+
+    // Priority class of messages sent on tag, Normal by default. Receivers dispatch higher
+    // classes first. Critical messages also skip aggregation and, over UDP, leave through a
+    // socket marked for expedited forwarding. A TCP connection is a single stream, so a critical
+    // message still waits behind bulk data already written to it; the latency of critical
+    // messages is only bounded over UDP.
+    void set_priority(uint8_t tag, MessagePriority priority);
+
+    // Rate limits every link to a module of type. Sends over a paced link are queued and go
+    // out as its token buckets allow, send returns once queued. Paced messages are not
+    // aggregated. nullopt stops pacing modules of type.
+    void set_pacing(ModuleType type, std::optional<PacingLimits> limits);
+    PacingStats pacing_stats(uint8_t module);
+
+    // What durable sends do once the destination is out of receive credits, see CreditGate.
+    // Hold by default. Modules that never grant credits are not flow controlled.
+    void set_credit_policy(CreditPolicy policy);
+    // Credits of the link to module, nullopt while it has not granted any.
+    std::optional<CreditStats> credit_stats(uint8_t module);
+
+    // Round trip time to a directly connected module, measured by heartbeats every
+    // HEARTBEAT_INTERVAL. nullopt until the module has answered one.
+    std::optional<RttEstimate> rtt_estimate(uint8_t module) const;
+    // How long remote_call and sendrecv wait for module: the time the module gets to do the
+    // work, plus a few RTOs for the messages to get there and back once the link has been
+    // measured.
+    std::chrono::milliseconds rpc_timeout(
+        uint8_t module, std::chrono::milliseconds processing_budget = FN_CALL_TIMEOUT) const;
+
+    // Durable messages to modules that acknowledge them are kept until acknowledged, and
+    // replayed when the connection comes back. This counts those dropped unacknowledged
+    // because more than REPLAY_BUFFER_SIZE were outstanding.
+    uint64_t replay_overflows(uint8_t module);
+
+    // Lossy messages are numbered per destination and tag. This reports the losses,
+    // duplicates and reordering seen on lossy messages from module, duplicates are dropped.
+    LossStats loss_stats(uint8_t module);
+    // Drops lossy messages on tag that arrive after a newer one from the same sender, so stale
+    // telemetry never reaches recv or subscribers.
+    void set_drop_stale(uint8_t tag, bool enabled);
+
+    // Retransmissions and gaps of messages sent with a deadline, to and from module.
+    NackStats nack_stats(uint8_t module);
+
   private:
+    using MessageQueue = BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>;
+
+    // Receive queues for one tag, indexed by source so demultiplexing is two array reads.
+    struct TagQueues {
+        std::unique_ptr<MessageQueue> any;
+        std::array<std::unique_ptr<MessageQueue>, 256> from_source;
+    };
+
+    MessagingInterface(std::unique_ptr<IDiscoveryService> discovery_service,
+                       std::optional<std::filesystem::path> discovery_cache);
+
     void handle_recv();
+    void dispatch(std::unique_ptr<std::vector<uint8_t>> data, bool unpack_aggregate);
+    bool deliver_to_subscribers(const Messaging::MPIMessage *mpi_message);
+    void update_module_state(const Messaging::MPIMessage *mpi_message);
+    MessageQueue &recv_queue(int source, uint8_t tag);
+    MessageQueue &dispatch_queue(uint8_t source, uint8_t tag);
+    template <typename F> static void for_each_queue(const TagQueues &queues, F &&f);
+    static std::optional<SizeAndSource> read_message(const std::vector<uint8_t> &data,
+                                                     uint8_t *buffer, size_t size);
+    bool on_dispatcher(const char *call) const;
+    static bool distinct(const std::vector<uint8_t> &modules);
+    static int wait_all(std::vector<std::future<int>> &sends);
+    void register_tracker(const std::shared_ptr<CompletionTracker> &tracker);
+    void unregister_tracker(const std::shared_ptr<CompletionTracker> &tracker);
+    bool take_reply(uint8_t source, uint8_t tag, std::unique_ptr<std::vector<uint8_t>> &data);
     void handle_fn_recv();
+    void handle_module_events();
+    void handle_heartbeats();
+    void handle_heartbeat(const Messaging::MPIMessage *mpi_message);
+    void connect_new_modules();
+    void disconnect_module(uint8_t module_id);
+    std::shared_ptr<ICommunicationClient> client_for(uint8_t destination, bool durable) const;
+    std::vector<uint8_t> encode_payload(const uint8_t *buffer, size_t size, uint8_t tag,
+                                        bool compress, uint8_t &flags) const;
+    int send_message(uint8_t *buffer, size_t size, uint8_t destination, uint8_t tag,
+                     bool durable, std::optional<std::chrono::milliseconds> deadline,
+                     std::optional<std::promise<int>> &completion);
+    void send_nack(uint8_t destination, uint16_t newest_sent,
+                   const std::vector<uint16_t> &missing);
+    void handle_nack(const Messaging::MPIMessage *mpi_message);
+    void set_accepts_compression(const mDNSRobotModule &module);
+    const PacingLimits *pacing_limits(uint8_t hop) const;
+    uint16_t next_sequence(uint8_t destination);
+    uint16_t next_lossy_sequence(uint8_t destination, uint8_t tag);
+    std::vector<std::vector<uint8_t>> replay_frames(uint8_t hop);
+    std::vector<std::vector<uint8_t>> reconnected(uint8_t hop,
+                                                  const std::weak_ptr<ICommunicationClient> &link);
+    void send_released(uint8_t hop, std::shared_ptr<ICommunicationClient> client,
+                       std::vector<uint8_t> frame, MessagePriority priority,
+                       std::optional<std::promise<int>> completion);
+    CreditResult acquire_durable(uint8_t link, const std::shared_ptr<ICommunicationClient> &client,
+                                 uint8_t destination, uint16_t sequence, MessagePriority priority,
+                                 const uint8_t *data, size_t size,
+                                 std::optional<std::promise<int>> &completion);
 
-    uint16_t m_sequence_number = 0;
+    // Durable messages are numbered per destination and de-duplicated per sender.
+    std::array<std::atomic<uint16_t>, 256> m_next_sequence{};
+    std::array<SequenceWindow, 256> m_received_sequences;
+    ReplayBuffer m_replay_buffer;
+    // Lossy messages are numbered per destination << 8 | tag.
+    std::unique_ptr<std::array<std::atomic<uint16_t>, 256 * 256>> m_lossy_sequences;
+    LossTracker m_loss_tracker;
+    // Messages sent with a deadline, numbered per destination.
+    std::unique_ptr<NackChannel> m_nack_channel;
+    std::array<std::atomic<bool>, 256> m_drop_stale_tags{};
     uint8_t unique_fn_call_id = 0; // this is designed to overflow, change to uint16_t if we plan on
                                    // having way more calls per second.
     std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> m_id_to_lossless_client;
     std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> m_id_to_lossy_client;
-    std::unordered_map<int, std::unique_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>>>
-        m_tag_to_queue_map;
+    std::unordered_map<uint8_t, std::string> m_id_to_ip;
+    std::unordered_map<uint8_t, ModuleType> m_id_to_type;
+    std::unordered_set<uint8_t> m_accepts_compression;
+    std::unordered_map<ModuleType, PacingLimits> m_pacing_limits;
+    RoutingTable m_routing_table;
+    std::array<std::unique_ptr<TagQueues>, 256> m_tag_queues;
+    std::array<OverflowPolicy, 256> m_tag_policies{};
+    std::array<std::vector<std::pair<SubscriptionId, std::shared_ptr<Subscription>>>, 256>
+        m_subscriptions;
+    SubscriptionId m_next_subscription_id = 1;
     // The semaphore needs to be in a unique_ptr, since it is not copyable or
     // movable unordered_maps need to copy/move to reshuffle.
     std::unordered_map<uint8_t, std::unique_ptr<std::binary_semaphore>> m_fn_call_to_semaphore;
     std::unordered_map<uint8_t, std::unique_ptr<std::vector<uint8_t>>> m_fn_call_to_result;
+    // Keyed by source << 8 | tag, oldest waiter first.
+    std::unordered_map<uint16_t, std::deque<std::shared_ptr<CompletionTracker>>> m_reply_trackers;
+    std::atomic<size_t> m_pending_replies = 0;
     std::unique_ptr<IDiscoveryService> m_discovery_service;
-    std::atomic<bool> m_stop_flag;
-    std::thread m_rx_thread;
-    std::thread m_fn_rx_thread;
-    std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> m_rx_queue;
+    std::unique_ptr<MessageAggregator> m_aggregator;
+    std::unique_ptr<ConflatingSender> m_conflating_sender;
+    std::unique_ptr<PacedSender> m_pacer;
+    CreditGate m_credit_gate;
+    LinkMonitor m_link_monitor;
+    std::atomic<CreditPolicy> m_credit_policy = CreditPolicy::Hold;
+    std::array<std::atomic<bool>, 256> m_compressed_tags{};
+    std::array<std::atomic<MessagePriority>, 256> m_tag_priorities{};
+    ModuleStateCache m_module_states;
+    std::atomic<int> m_state_tag = -1;
+    std::shared_ptr<PriorityRxQueue> m_rx_queue;
+    std::unique_ptr<BlockingQueue<ModuleChange>> m_module_event_queue;
     std::shared_mutex m_client_mutex;
     std::shared_mutex m_scan_mutex;
     std::mutex m_fn_call_mutex;
     std::mutex m_tag_queue_mutex;
+    std::shared_mutex m_subscription_mutex;
+    std::mutex m_reply_mutex;
+    // One wakeup for every recv_any caller, bumped by the dispatcher while any are waiting.
+    std::mutex m_recv_any_mutex;
+    std::condition_variable m_recv_any_cond;
+    uint64_t m_recv_any_generation = 0;
+    std::atomic<size_t> m_recv_any_waiters = 0;
+    // Threads last, so everything they touch is constructed before they start.
+    std::atomic<bool> m_stop_flag;
+    std::thread m_rx_thread;
+    std::thread m_fn_rx_thread;
+    std::thread m_module_event_thread;
+    std::thread m_heartbeat_thread;
 };
 
 #endif // RPC_LIBRARY_H
@@ -5,12 +5,19 @@
 #ifndef MDNSDISCOVERYSERVICE_H
 #define MDNSDISCOVERYSERVICE_H
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 
-#include "BlockingQueue.h"
 #include "ICommunicationClient.h"
 #include "IDiscoveryService.h"
+#include "ModuleRegistry.h"
+#include "PriorityRxQueue.h"
+#include "mDNSParser.h"
 #include "mDNSRobotModule.h"
 
 #ifdef _WIN32
@@ -22,35 +29,66 @@ typedef SOCKET socket_t;
 #else
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <sys/select.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #define CLOSE_SOCKET close
 typedef int socket_t;
 #endif
 
+// Browses for modules continuously on a background thread. The socket stays open, every
+// pending response is drained on readiness and the registry of modules is kept live, so
+// find_modules only has to wait while the browser is still starting up.
+//
+// Queries list the modules already known (RFC 6762 known-answer suppression), so in steady
+// state only modules whose records are going stale answer, and the query interval backs off
+// while the fleet is not changing, to once a minute or half the shortest TTL. Records close to
+// expiry are refreshed on their own schedule.
+//
+// With a cache path, the modules seen by the previous run are loaded up front and reported
+// straight away, while the browser confirms them (or lets them expire) in the background.
 class mDNSDiscoveryService final : public IDiscoveryService {
 
   public:
-    mDNSDiscoveryService();
+    explicit mDNSDiscoveryService(std::optional<std::filesystem::path> cache_path = std::nullopt);
     ~mDNSDiscoveryService() override;
     std::unordered_set<uint8_t> find_modules(std::chrono::duration<double> wait_time) override;
+    std::unordered_map<uint8_t, mDNSRobotModule> get_modules() override;
+    void add_module_callback(ModuleEventCallback callback) override;
     std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> get_lossy_clients(
-        const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
+        const std::shared_ptr<PriorityRxQueue> &rx_queue,
         std::vector<uint8_t> &skip_modules) override;
     std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> get_lossless_clients(
-        const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
+        const std::shared_ptr<PriorityRxQueue> &rx_queue,
         std::vector<uint8_t> &skip_modules) override;
 
   private:
-    template <typename T>
-    std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> create_clients(
-        const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
-        std::vector<uint8_t> &skip_modules);
-    static void send_mdns_query(socket_t sock, const sockaddr_in &addr);
-    static std::optional<mDNSRobotModule> parse_response(uint8_t *buffer, int size);
-    static std::tuple<std::string, int> read_mdns_name(const uint8_t *buffer, int size, int ptr);
-
-    std::unordered_map<uint8_t, mDNSRobotModule> module_to_mdns{};
+    void browse_thread();
+    socket_t open_socket();
+    void drain_responses(socket_t sock);
+    void handle_response(const mDNSResponse &response);
+    void expire_modules();
+    void notify(ModuleEvent event, const mDNSRobotModule &module);
+    void save_cache();
+    void reset_query_backoff();
+    std::chrono::steady_clock::duration max_query_interval() const;
+    static void send_mdns_query(socket_t sock, const sockaddr_in &addr,
+                                const std::vector<KnownAnswer> &known_answers,
+                                bool unicast_response);
+
+    ModuleRegistry m_registry;
+    std::vector<ModuleEventCallback> m_callbacks;
+    std::optional<std::filesystem::path> m_cache_path;
+    bool m_warm_started = false;
+    std::chrono::steady_clock::time_point m_started;
+    // Query schedule, only touched by the browse thread
+    std::chrono::steady_clock::time_point m_next_query;
+    std::chrono::steady_clock::duration m_query_interval{};
+    std::mutex m_callback_mutex;
+    std::mutex m_stop_mutex;
+    std::condition_variable m_stop_cond;
+    std::atomic<bool> m_stop_flag;
+    std::thread m_thread;
 };
 
 #endif // MDNSDISCOVERYSERVICE_H
@@ -0,0 +1,46 @@
+#ifndef MDNSPARSER_H
+#define MDNSPARSER_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include "mDNSRobotModule.h"
+
+constexpr auto MDNS_MAX_NAME_LENGTH = 255;
+
+// What a response says about one robot module, handed to the ModuleRegistry.
+struct mDNSResponse {
+    mDNSRobotModule module;
+    std::chrono::seconds ttl; // shortest TTL of the module's A and TXT records
+    std::string instance;     // service instance name from the PTR record, if there was one
+    std::optional<std::chrono::seconds> ptr_ttl; // TTL of that PTR record
+};
+
+// A decoded domain name in dotted form, stored inline so reading one never allocates.
+struct mDNSName {
+    std::array<char, MDNS_MAX_NAME_LENGTH> data{};
+    size_t length = 0;
+
+    std::string_view view() const {
+        return {data.data(), length};
+    }
+};
+
+// Parses mDNS responses without writing to the packet or touching the heap, unless the
+// packet turns out to describe a robot module and a mDNSRobotModule has to be built.
+class mDNSParser {
+  public:
+    static std::optional<mDNSResponse> parse_response(std::span<const uint8_t> packet);
+
+    // Decodes the name at offset, following compression pointers. Returns the offset just past
+    // the name as it appears at offset, or nullopt if the name is malformed.
+    static std::optional<size_t> read_name(std::span<const uint8_t> packet, size_t offset,
+                                           mDNSName &name);
+};
+
+#endif // MDNSPARSER_H
@@ -14,6 +14,11 @@ struct mDNSRobotModule {
     std::string hostname;
     ModuleType module_type;
     std::vector<int> connected_module_ids;
+    // Decodes MPI_FLAG_COMPRESSED payloads, advertised as compression=lz in TXT. Firmware that
+    // predates compression would take the compressed bytes for application data.
+    bool lz_compression = false;
+
+    bool operator==(const mDNSRobotModule &) const = default;
 };
 
 #endif // ROBOTMODULEINSTANCE_H
@@ -0,0 +1,186 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+// A small LZ77 codec in the spirit of LZ4. A block is a uint16_t original size followed by
+// sequences of: token (literal length << 4 | match length - 4), extra literal length bytes,
+// literals, uint16_t match offset, extra match length bytes. The final sequence has no match.
+
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_HASH_BITS = 12;
+constexpr size_t LZ_MAX_OFFSET = UINT16_MAX;
+constexpr size_t LZ_MAX_INPUT = UINT16_MAX;
+
+inline uint32_t lz_read32(const uint8_t *p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint32_t lz_hash(const uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+inline void lz_write_length(std::vector<uint8_t> &out, size_t length) {
+    while (length >= 255) {
+        out.push_back(255);
+        length -= 255;
+    }
+    out.push_back(static_cast<uint8_t>(length));
+}
+
+inline void lz_write_sequence(std::vector<uint8_t> &out, const uint8_t *literals,
+                              const size_t literal_length, const size_t offset,
+                              const size_t match_length) {
+    const auto match_code = match_length ? match_length - LZ_MIN_MATCH : 0;
+    out.push_back(static_cast<uint8_t>((std::min<size_t>(literal_length, 15) << 4) |
+                                       std::min<size_t>(match_code, 15)));
+    if (literal_length >= 15) {
+        lz_write_length(out, literal_length - 15);
+    }
+    out.insert(out.end(), literals, literals + literal_length);
+
+    if (match_length) {
+        out.push_back(static_cast<uint8_t>(offset & 0xFF));
+        out.push_back(static_cast<uint8_t>(offset >> 8));
+        if (match_code >= 15) {
+            lz_write_length(out, match_code - 15);
+        }
+    }
+}
+
+inline std::optional<std::vector<uint8_t>> lz_compress(const uint8_t *src, const size_t size) {
+    if (size > LZ_MAX_INPUT) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> out;
+    out.reserve(size + size / 255 + 16);
+    const auto original_size = static_cast<uint16_t>(size);
+    out.resize(sizeof(original_size));
+    std::memcpy(out.data(), &original_size, sizeof(original_size));
+
+    // Positions are stored off by one so zero means empty.
+    std::array<uint32_t, 1 << LZ_HASH_BITS> table{};
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (pos + LZ_MIN_MATCH <= size) {
+        const auto sequence = lz_read32(src + pos);
+        auto &slot = table[lz_hash(sequence)];
+        const auto candidate = static_cast<size_t>(slot);
+        slot = static_cast<uint32_t>(pos + 1);
+
+        if (candidate == 0 || pos - (candidate - 1) > LZ_MAX_OFFSET ||
+            lz_read32(src + candidate - 1) != sequence) {
+            pos++;
+            continue;
+        }
+
+        const auto match = candidate - 1;
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < size && src[match + length] == src[pos + length]) {
+            length++;
+        }
+
+        lz_write_sequence(out, src + anchor, pos - anchor, pos - match, length);
+        pos += length;
+        anchor = pos;
+    }
+
+    lz_write_sequence(out, src + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+inline std::optional<size_t> lz_decompressed_size(const uint8_t *src, const size_t size) {
+    uint16_t original_size = 0;
+    if (size < sizeof(original_size)) {
+        return std::nullopt;
+    }
+    std::memcpy(&original_size, src, sizeof(original_size));
+    return original_size;
+}
+
+// Returns the decompressed size, or nullopt if the block is malformed or does not fit in dst.
+inline std::optional<size_t> lz_decompress(const uint8_t *src, const size_t size, uint8_t *dst,
+                                           const size_t capacity) {
+    uint16_t original_size = 0;
+    if (size < sizeof(original_size)) {
+        return std::nullopt;
+    }
+    std::memcpy(&original_size, src, sizeof(original_size));
+    if (original_size > capacity) {
+        return std::nullopt;
+    }
+
+    const auto read_length = [&](size_t &pos, size_t length) -> std::optional<size_t> {
+        uint8_t byte = 255;
+        while (byte == 255) {
+            if (pos >= size) {
+                return std::nullopt;
+            }
+            byte = src[pos++];
+            length += byte;
+        }
+        return length;
+    };
+
+    size_t in = sizeof(original_size);
+    size_t out = 0;
+    while (in < size) {
+        const auto token = src[in++];
+
+        size_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            const auto length = read_length(in, literal_length);
+            if (!length) {
+                return std::nullopt;
+            }
+            literal_length = *length;
+        }
+        if (literal_length > size - in || literal_length > original_size - out) {
+            return std::nullopt;
+        }
+        std::memcpy(dst + out, src + in, literal_length);
+        in += literal_length;
+        out += literal_length;
+
+        if (in == size) {
+            break; // the final sequence carries literals only
+        }
+
+        if (size - in < 2) {
+            return std::nullopt;
+        }
+        const size_t offset = src[in] | (src[in + 1] << 8);
+        in += 2;
+
+        size_t match_length = token & 0x0F;
+        if (match_length == 15) {
+            const auto length = read_length(in, match_length);
+            if (!length) {
+                return std::nullopt;
+            }
+            match_length = *length;
+        }
+        match_length += LZ_MIN_MATCH;
+
+        if (offset == 0 || offset > out || match_length > original_size - out) {
+            return std::nullopt;
+        }
+        // Byte by byte, matches may overlap their own output.
+        for (size_t i = 0; i < match_length; i++, out++) {
+            dst[out] = dst[out - offset];
+        }
+    }
+
+    return out == original_size ? std::optional{out} : std::nullopt;
+}
+
+#endif // COMPRESSION_H
@@ -0,0 +1,45 @@
+#ifndef QOS_H
+#define QOS_H
+
+#include "MessagePriority.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+// DSCP code points, shifted into the IP TOS byte.
+constexpr int DSCP_EF = 46 << 2;   // expedited forwarding, critical traffic
+constexpr int DSCP_AF21 = 18 << 2; // low latency data
+constexpr int DSCP_CS1 = 8 << 2;   // lower effort, bulk transfers
+
+// Marks everything sent on sock with the DSCP class for priority, which Wi-Fi maps to a WMM
+// access category, and on Linux also the matching queueing discipline band. Best effort, a
+// network that ignores the marking just treats the traffic as before.
+template <typename Socket>
+void set_socket_priority(const Socket sock, const MessagePriority priority) {
+    int tos = DSCP_AF21;
+    int so_priority = 4;
+    if (priority == MessagePriority::Critical) {
+        tos = DSCP_EF;
+        so_priority = 6; // highest without CAP_NET_ADMIN
+    } else if (priority == MessagePriority::Bulk) {
+        tos = DSCP_CS1;
+        so_priority = 1;
+    }
+
+#ifdef _WIN32
+    setsockopt(sock, IPPROTO_IP, IP_TOS, (char *)&tos, sizeof(tos));
+#else
+    setsockopt(sock, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+#ifdef SO_PRIORITY
+    setsockopt(sock, SOL_SOCKET, SO_PRIORITY, &so_priority, sizeof(so_priority));
+#endif
+#endif
+    (void)so_priority;
+}
+
+#endif // QOS_H
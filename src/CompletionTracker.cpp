@@ -0,0 +1,28 @@
+#include "CompletionTracker.h"
+
+CompletionTracker::CompletionTracker(std::vector<uint8_t> sources, const uint8_t tag)
+    : m_sources(std::move(sources)), m_tag(tag) {
+}
+
+void CompletionTracker::complete(const uint8_t source,
+                                 std::unique_ptr<std::vector<uint8_t>> message) {
+    std::unique_lock lock(m_mutex);
+    m_results.try_emplace(source, std::move(message));
+    const bool done = m_results.size() >= m_sources.size();
+    lock.unlock();
+
+    if (done) {
+        m_cond.notify_all();
+    }
+}
+
+bool CompletionTracker::wait_for(const std::chrono::milliseconds timeout) {
+    std::unique_lock lock(m_mutex);
+    return m_cond.wait_for(lock, timeout, [this] { return m_results.size() >= m_sources.size(); });
+}
+
+std::unordered_map<uint8_t, std::unique_ptr<std::vector<uint8_t>>>
+CompletionTracker::take_results() {
+    std::scoped_lock lock(m_mutex);
+    return std::move(m_results);
+}
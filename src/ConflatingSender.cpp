@@ -0,0 +1,64 @@
+#include "ConflatingSender.h"
+#include "spdlog/spdlog.h"
+
+ConflatingSender::ConflatingSender(SendFunction send) : m_send(std::move(send)) {
+}
+
+ConflatingSender::~ConflatingSender() {
+    {
+        std::scoped_lock lock(m_mutex);
+        for (auto &[_, state] : m_destinations) {
+            state->stop = true;
+            state->cond.notify_one();
+        }
+    }
+
+    for (auto &[_, state] : m_destinations) {
+        state->thread.join();
+    }
+}
+
+void ConflatingSender::submit(const uint8_t destination, const uint8_t tag, const bool durable,
+                              std::vector<uint8_t> payload) {
+    const auto key = static_cast<uint16_t>(tag << 1 | (durable ? 1 : 0));
+
+    std::scoped_lock lock(m_mutex);
+    auto &state = m_destinations[destination];
+    if (!state) {
+        state = std::make_unique<Destination>();
+        state->thread = std::thread(&ConflatingSender::send_thread, this, destination,
+                                    std::ref(*state));
+    }
+
+    const auto [_, inserted] = state->pending.insert_or_assign(key, std::move(payload));
+    if (!inserted) {
+        m_conflated++;
+        return; // already in line
+    }
+    state->order.push_back(key);
+    state->cond.notify_one();
+}
+
+void ConflatingSender::send_thread(const uint8_t destination, Destination &state) {
+    std::unique_lock lock(m_mutex);
+    while (!state.stop) {
+        if (state.order.empty()) {
+            state.cond.wait(lock);
+            continue;
+        }
+
+        const auto key = state.order.front();
+        state.order.pop_front();
+        auto payload = std::move(state.pending.extract(key).mapped());
+        lock.unlock();
+
+        const auto tag = static_cast<uint8_t>(key >> 1);
+        if (m_send(destination, tag, (key & 1) != 0, payload) < 0) {
+            // The caller got 0 from send_latest long ago, this is the only trace of the loss.
+            spdlog::warn("[Conflate] Failed to send the latest update on tag {} to {}", tag,
+                         destination);
+        }
+
+        lock.lock();
+    }
+}
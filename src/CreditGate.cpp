@@ -0,0 +1,81 @@
+#include "CreditGate.h"
+
+#include <vector>
+
+#undef min
+#include <algorithm>
+
+CreditGate::~CreditGate() {
+    for (auto &[_, state] : m_modules) {
+        for (auto &release : state.held) {
+            release(false);
+        }
+    }
+}
+
+void CreditGate::grant(const uint8_t module, const uint8_t credits) {
+    if (credits == 0) {
+        return;
+    }
+
+    std::unique_lock lock(m_mutex);
+    auto &state = m_modules[module];
+    state.credits = std::min(state.credits + credits, MAX_CREDITS);
+    if (state.releasing) {
+        return; // picked up by the grant already sending
+    }
+
+    // Sending does not belong under the lock, but sends made meanwhile must not overtake the
+    // released messages. They are held while releasing is set, then released in turn.
+    std::vector<Release> released;
+    while (true) {
+        const auto it = m_modules.find(module);
+        if (it == m_modules.end()) {
+            return; // removed meanwhile
+        }
+        auto &current = it->second;
+        current.releasing = false;
+        while (current.credits > 0 && !current.held.empty()) {
+            current.credits--;
+            released.push_back(std::move(current.held.front()));
+            current.held.pop_front();
+        }
+        if (released.empty()) {
+            return;
+        }
+        current.releasing = true;
+        lock.unlock();
+
+        for (auto &release : released) {
+            release(true);
+        }
+        released.clear();
+        lock.lock();
+    }
+}
+
+void CreditGate::remove(const uint8_t module) {
+    std::deque<Release> held;
+    {
+        std::scoped_lock lock(m_mutex);
+        const auto it = m_modules.find(module);
+        if (it == m_modules.end()) {
+            return;
+        }
+        held = std::move(it->second.held);
+        m_modules.erase(it);
+    }
+
+    for (auto &release : held) {
+        release(false);
+    }
+}
+
+std::optional<CreditStats> CreditGate::stats(const uint8_t module) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_modules.find(module);
+    if (it == m_modules.end()) {
+        return std::nullopt;
+    }
+    return CreditStats{it->second.credits, it->second.held.size(), it->second.exhausted};
+}
@@ -0,0 +1,110 @@
+#include <charconv>
+#include <fstream>
+#include <optional>
+#include <sstream>
+#include <string_view>
+
+#include "DiscoveryCache.h"
+#include "spdlog/spdlog.h"
+#include "util/string.h"
+
+constexpr auto EMPTY_LIST = "-";
+constexpr auto LZ_COMPRESSION = "lz";
+
+static std::optional<uint8_t> parse_id(const std::string_view s) {
+    uint8_t value = 0;
+    const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (error != std::errc{} || end != s.data() + s.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+static bool parse_ids(const std::string &list, std::vector<int> &ids) {
+    for (const auto &token : split(list, ',')) {
+        const auto id = parse_id(token);
+        if (!id) {
+            return false;
+        }
+        ids.emplace_back(*id);
+    }
+    return true;
+}
+
+std::vector<mDNSRobotModule> DiscoveryCache::load(const std::filesystem::path &path) {
+    std::vector<mDNSRobotModule> modules;
+    std::ifstream file(path);
+    if (!file) {
+        return modules;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        mDNSRobotModule module{};
+        std::string id;
+        int module_type = 0;
+        std::string connected;
+        fields >> id >> module.ip >> module.hostname >> module_type >> connected;
+        const auto module_id = fields ? parse_id(id) : std::nullopt;
+        if (!module_id ||
+            (connected != EMPTY_LIST && !parse_ids(connected, module.connected_module_ids))) {
+            spdlog::warn("[Cache] Skipping malformed line in {}", path.string());
+            continue;
+        }
+
+        module.id = *module_id;
+        module.module_type = static_cast<ModuleType>(module_type);
+        if (module.hostname == EMPTY_LIST) {
+            module.hostname.clear();
+        }
+        std::string compression;
+        module.lz_compression = fields >> compression && compression == LZ_COMPRESSION;
+        modules.emplace_back(std::move(module));
+    }
+
+    return modules;
+}
+
+bool DiscoveryCache::save(const std::filesystem::path &path,
+                          const std::unordered_map<uint8_t, mDNSRobotModule> &modules) {
+    // Write then rename, so a crash never leaves a half written cache behind.
+    auto temp_path = path;
+    temp_path += ".tmp";
+
+    {
+        std::ofstream file(temp_path, std::ios::trunc);
+        if (!file) {
+            spdlog::warn("[Cache] Unable to write {}", temp_path.string());
+            return false;
+        }
+
+        for (const auto &[id, module] : modules) {
+            file << module.id << ' ' << module.ip << ' '
+                 << (module.hostname.empty() ? EMPTY_LIST : module.hostname) << ' '
+                 << static_cast<int>(module.module_type) << ' ';
+            if (module.connected_module_ids.empty()) {
+                file << EMPTY_LIST;
+            }
+            for (size_t i = 0; i < module.connected_module_ids.size(); i++) {
+                file << (i > 0 ? "," : "") << module.connected_module_ids[i];
+            }
+            if (module.lz_compression) {
+                file << ' ' << LZ_COMPRESSION;
+            }
+            file << '\n';
+        }
+
+        if (!file) {
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temp_path, path, error);
+    if (error) {
+        spdlog::warn("[Cache] Unable to replace {}: {}", path.string(), error.message());
+        return false;
+    }
+    return true;
+}
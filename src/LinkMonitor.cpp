@@ -0,0 +1,67 @@
+#include "LinkMonitor.h"
+
+#undef min
+#undef max
+#include <algorithm>
+
+void RttEstimator::sample(const std::chrono::microseconds rtt) {
+    if (m_samples++ == 0) {
+        m_srtt = rtt;
+        m_rttvar = rtt / 2;
+        return;
+    }
+
+    // Gains of 1/4 and 1/8, deviation first since it uses the old SRTT.
+    const auto deviation = std::chrono::abs(m_srtt - rtt);
+    m_rttvar = (3 * m_rttvar + deviation) / 4;
+    m_srtt = (7 * m_srtt + rtt) / 8;
+}
+
+std::optional<RttEstimate> RttEstimator::estimate() const {
+    if (m_samples == 0) {
+        return std::nullopt;
+    }
+
+    const auto rto = std::clamp<std::chrono::microseconds>(m_srtt + 4 * m_rttvar, RTO_MIN,
+                                                           RTO_MAX);
+    return RttEstimate{m_srtt, m_rttvar, rto, m_samples};
+}
+
+void LinkMonitor::heard_from(const uint8_t module, const Clock::time_point now) {
+    m_last_heard[module].store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    if (m_reported_silent[module].load(std::memory_order_relaxed)) {
+        m_reported_silent[module].store(false, std::memory_order_relaxed);
+    }
+}
+
+void LinkMonitor::record_rtt(const uint8_t module, const std::chrono::microseconds rtt) {
+    std::scoped_lock lock(m_mutex);
+    m_estimators[module].sample(rtt);
+}
+
+void LinkMonitor::remove(const uint8_t module) {
+    std::scoped_lock lock(m_mutex);
+    m_estimators.erase(module);
+    m_reported_silent[module] = false;
+}
+
+std::vector<uint8_t> LinkMonitor::silent_modules(const std::chrono::milliseconds timeout,
+                                                 const Clock::time_point now) {
+    std::scoped_lock lock(m_mutex);
+    std::vector<uint8_t> silent;
+    for (const auto &[module, estimator] : m_estimators) {
+        const auto last_heard = Clock::time_point(
+            Clock::duration(m_last_heard[module].load(std::memory_order_relaxed)));
+        if (now - last_heard > timeout + estimator.estimate()->rto &&
+            !m_reported_silent[module].exchange(true, std::memory_order_relaxed)) {
+            silent.push_back(module);
+        }
+    }
+    return silent;
+}
+
+std::optional<RttEstimate> LinkMonitor::estimate(const uint8_t module) const {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_estimators.find(module);
+    return it == m_estimators.end() ? std::nullopt : it->second.estimate();
+}
@@ -0,0 +1,75 @@
+#include "LossTracker.h"
+
+Arrival LossTracker::track(const uint8_t sender, const uint8_t tag, const uint16_t sequence,
+                           const uint32_t session) {
+    const auto key = static_cast<uint16_t>(sender << 8 | tag);
+
+    std::scoped_lock lock(m_mutex);
+    if (m_sessions[sender] != session) {
+        m_sessions[sender] = session;
+        erase_streams(sender); // restarted, every stream is numbered from 1 again
+    }
+
+    auto &stats = m_stats[sender];
+    const auto [it, inserted] = m_streams.try_emplace(key);
+    auto &stream = it->second;
+    const auto distance = static_cast<int16_t>(sequence - stream.newest);
+
+    if (inserted) {
+        stream = Stream{sequence, 1};
+        stats.received++;
+        return Arrival::InOrder;
+    }
+    if (distance <= -LOSS_WINDOW) {
+        // Too old to tell whether it is a duplicate, or which gap it fills.
+        stats.reordered++;
+        stats.received++;
+        return Arrival::Late;
+    }
+
+    if (distance > 0) {
+        // Everything in between is missing for now. 0 is never sent, so it is not a gap.
+        const bool wrapped = sequence < stream.newest;
+        stats.lost += static_cast<uint64_t>(distance - 1 - (wrapped ? 1 : 0));
+        stream.seen = distance >= LOSS_WINDOW ? 0 : stream.seen << distance;
+        stream.seen |= 1;
+        stream.newest = sequence;
+        stats.received++;
+        return Arrival::InOrder;
+    }
+
+    const auto bit = uint64_t{1} << -distance;
+    if (stream.seen & bit) {
+        stats.duplicates++;
+        return Arrival::Duplicate;
+    }
+
+    // Counted as lost when the newer one arrived, it was only late.
+    stream.seen |= bit;
+    if (stats.lost > 0) {
+        stats.lost--;
+    }
+    stats.reordered++;
+    stats.received++;
+    return Arrival::Late;
+}
+
+void LossTracker::reset(const uint8_t sender) {
+    std::scoped_lock lock(m_mutex);
+    erase_streams(sender);
+}
+
+// Must be called with m_mutex held.
+void LossTracker::erase_streams(const uint8_t sender) {
+    std::erase_if(m_streams, [sender](const auto &stream) { return stream.first >> 8 == sender; });
+}
+
+void LossTracker::count_stale_drop(const uint8_t sender) {
+    std::scoped_lock lock(m_mutex);
+    m_stats[sender].dropped_stale++;
+}
+
+LossStats LossTracker::stats(const uint8_t module) {
+    std::scoped_lock lock(m_mutex);
+    return m_stats[module];
+}
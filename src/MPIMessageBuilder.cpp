@@ -2,8 +2,15 @@
 // Created by Johnathon Slightham on 2025-06-30.
 //
 
+#include <cstring>
+#include <random>
+
+#undef min
+#include <algorithm>
+
 #include "flatbuffers/MPIMessageBuilder.h"
 #include "flatbuffers/SerializedMessage.h"
+#include "util/compression.h"
 
 namespace Flatbuffers {
 SerializedMessage MPIMessageBuilder::build_mpi_message(const Messaging::MessageType type,
@@ -11,14 +18,15 @@ SerializedMessage MPIMessageBuilder::build_mpi_message(const Messaging::MessageT
                                                        const uint8_t destination,
                                                        const uint16_t sequence_number,
                                                        const bool is_durable, const uint8_t tag,
-                                                       const std::vector<uint8_t> &payload) {
+                                                       const std::vector<uint8_t> &payload,
+                                                       const uint8_t flags, const uint16_t ack) {
     builder_.Clear();
 
     const auto payload_vector = builder_.CreateVector(payload);
 
     const auto message = Messaging::CreateMPIMessage(
         builder_, type, sender, destination, sequence_number, is_durable,
-        static_cast<int>(payload.size()), tag, payload_vector);
+        static_cast<int>(payload.size()), tag, payload_vector, flags, 0, ack, session());
 
     builder_.Finish(message);
 
@@ -28,4 +36,79 @@ SerializedMessage MPIMessageBuilder::build_mpi_message(const Messaging::MessageT
 const Messaging::MPIMessage *MPIMessageBuilder::parse_mpi_message(const uint8_t *buffer) {
     return flatbuffers::GetRoot<Messaging::MPIMessage>(buffer);
 }
+
+uint32_t MPIMessageBuilder::session() {
+    static const uint32_t session = [] {
+        std::random_device device;
+        uint32_t value = 0;
+        while (value == 0) {
+            value = device();
+        }
+        return value;
+    }();
+    return session;
+}
+
+std::optional<size_t> MPIMessageBuilder::read_payload(const Messaging::MPIMessage *message,
+                                                      uint8_t *buffer, const size_t size) {
+    const auto payload = message->payload();
+    if (!payload) {
+        return 0;
+    }
+    const auto payload_size = std::min(static_cast<size_t>(message->length()),
+                                       static_cast<size_t>(payload->size()));
+
+    if (!(message->flags() & MPI_FLAG_COMPRESSED)) {
+        const auto data_size = std::min(size, payload_size);
+        std::memcpy(buffer, payload->data(), data_size);
+        return data_size;
+    }
+
+    const auto original_size = lz_decompressed_size(payload->data(), payload_size);
+    if (!original_size) {
+        return std::nullopt;
+    }
+    if (*original_size <= size) {
+        return lz_decompress(payload->data(), payload_size, buffer, size);
+    }
+
+    // The caller's buffer is too small, decode in full and truncate like an uncompressed
+    // payload would be.
+    std::vector<uint8_t> decompressed(*original_size);
+    const auto written =
+        lz_decompress(payload->data(), payload_size, decompressed.data(), decompressed.size());
+    if (!written) {
+        return std::nullopt;
+    }
+
+    const auto data_size = std::min(size, *written);
+    std::memcpy(buffer, decompressed.data(), data_size);
+    return data_size;
+}
+
+std::optional<std::vector<uint8_t>>
+MPIMessageBuilder::read_payload(const Messaging::MPIMessage *message) {
+    const auto payload = message->payload();
+    if (!payload) {
+        return std::vector<uint8_t>{};
+    }
+    const auto payload_size = std::min(static_cast<size_t>(message->length()),
+                                       static_cast<size_t>(payload->size()));
+
+    auto size = std::optional{payload_size};
+    if (message->flags() & MPI_FLAG_COMPRESSED) {
+        size = lz_decompressed_size(payload->data(), payload_size);
+    }
+    if (!size) {
+        return std::nullopt;
+    }
+
+    std::vector<uint8_t> data(*size);
+    const auto written = read_payload(message, data.data(), data.size());
+    if (!written) {
+        return std::nullopt;
+    }
+    data.resize(*written);
+    return data;
+}
 } // namespace Flatbuffers
@@ -0,0 +1,184 @@
+#include <cstring>
+
+#undef min
+#include <algorithm>
+
+#include "MessageAggregator.h"
+#include "flatbuffers/MPIMessageBuilder.h"
+#include "spdlog/spdlog.h"
+
+constexpr auto FLUSH_THREAD_IDLE_WAIT = std::chrono::milliseconds(250);
+constexpr auto ENTRY_HEADER_SIZE = sizeof(uint16_t);
+
+MessageAggregator::MessageAggregator(const std::chrono::microseconds max_delay,
+                                     const size_t max_frame_size)
+    : m_max_delay(max_delay), m_max_frame_size(max_frame_size), m_stop_flag(false),
+      m_thread(std::thread(&MessageAggregator::flush_thread, this)) {
+}
+
+MessageAggregator::~MessageAggregator() {
+    m_stop_flag = true;
+    m_cond.notify_one();
+    m_thread.join();
+    flush();
+}
+
+int MessageAggregator::enqueue(const std::shared_ptr<ICommunicationClient> &client,
+                               const bool durable, const MessagePriority priority,
+                               const uint8_t *data, const size_t size) {
+    const auto entry_size = size + ENTRY_HEADER_SIZE;
+    const FrameKey key{client.get(), priority};
+
+    // Too large to share a frame, send it on its own behind anything already pending.
+    if (entry_size > m_max_frame_size) {
+        std::scoped_lock send_lock(m_send_mutex);
+        for (auto &frame : take_frames(client.get())) {
+            send_frame(frame);
+        }
+        return client->send_msg(const_cast<uint8_t *>(data), size, priority) < 0 ? -1 : 0;
+    }
+
+    std::unique_lock lock(m_mutex);
+    for (auto it = m_pending.find(key);
+         it != m_pending.end() && it->second.payload.size() + entry_size > m_max_frame_size;
+         it = m_pending.find(key)) {
+        lock.unlock();
+        {
+            std::scoped_lock send_lock(m_send_mutex);
+            for (auto &frame : take_frames(client.get())) {
+                send_frame(frame);
+            }
+        }
+        lock.lock();
+    }
+
+    auto &frame = m_pending[key];
+    const bool new_frame = frame.count == 0;
+    if (new_frame) {
+        frame.client = client;
+        frame.durable = durable;
+        frame.priority = priority;
+        frame.deadline = std::chrono::steady_clock::now() + m_max_delay;
+        frame.payload.reserve(m_max_frame_size);
+    }
+
+    const auto length = static_cast<uint16_t>(size);
+    const auto offset = frame.payload.size();
+    frame.payload.resize(offset + entry_size);
+    std::memcpy(frame.payload.data() + offset, &length, ENTRY_HEADER_SIZE);
+    std::memcpy(frame.payload.data() + offset + ENTRY_HEADER_SIZE, data, size);
+    frame.count++;
+    lock.unlock();
+
+    if (new_frame) {
+        m_cond.notify_one();
+    }
+
+    return 0;
+}
+
+void MessageAggregator::flush() {
+    std::scoped_lock send_lock(m_send_mutex);
+    for (auto &frame : take_frames(nullptr)) {
+        send_frame(frame);
+    }
+}
+
+void MessageAggregator::unpack(const Messaging::MPIMessage *frame,
+                               const std::function<void(const uint8_t *, size_t)> &callback) {
+    const auto payload = frame->payload();
+    if (!payload) {
+        return;
+    }
+
+    size_t offset = 0;
+    while (offset + ENTRY_HEADER_SIZE <= payload->size()) {
+        uint16_t length = 0;
+        std::memcpy(&length, payload->data() + offset, ENTRY_HEADER_SIZE);
+        offset += ENTRY_HEADER_SIZE;
+
+        if (length == 0 || offset + length > payload->size()) {
+            spdlog::warn("[Aggregator] Truncated entry in aggregate frame");
+            return;
+        }
+
+        callback(payload->data() + offset, length);
+        offset += length;
+    }
+}
+
+void MessageAggregator::flush_thread() {
+    while (!m_stop_flag) {
+        std::unique_lock lock(m_mutex);
+        auto next_deadline = std::chrono::steady_clock::now() + FLUSH_THREAD_IDLE_WAIT;
+        for (const auto &[_, frame] : m_pending) {
+            next_deadline = std::min(next_deadline, frame.deadline);
+        }
+        m_cond.wait_until(lock, next_deadline);
+        lock.unlock();
+
+        flush_expired();
+    }
+}
+
+void MessageAggregator::flush_expired() {
+    std::scoped_lock send_lock(m_send_mutex);
+    std::vector<PendingFrame> frames;
+    {
+        std::scoped_lock lock(m_mutex);
+        const auto now = std::chrono::steady_clock::now();
+        for (auto it = m_pending.begin(); it != m_pending.end();) {
+            if (it->second.deadline <= now) {
+                frames.push_back(std::move(it->second));
+                it = m_pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    for (auto &frame : frames) {
+        send_frame(frame);
+    }
+}
+
+// Removes the pending frames for client, or every pending frame if client is null.
+std::vector<MessageAggregator::PendingFrame>
+MessageAggregator::take_frames(ICommunicationClient *client) {
+    std::scoped_lock lock(m_mutex);
+    std::vector<PendingFrame> frames;
+
+    if (client) {
+        auto it = m_pending.lower_bound({client, MessagePriority::Normal});
+        while (it != m_pending.end() && it->first.first == client) {
+            frames.push_back(std::move(it->second));
+            it = m_pending.erase(it);
+        }
+        return frames;
+    }
+
+    frames.reserve(m_pending.size());
+    for (auto &[_, frame] : m_pending) {
+        frames.push_back(std::move(frame));
+    }
+    m_pending.clear();
+    return frames;
+}
+
+int MessageAggregator::send_frame(PendingFrame &frame) {
+    if (frame.count == 0) {
+        return 0;
+    }
+
+    // A lone message goes out as-is, there is nothing to save by wrapping it.
+    if (frame.count == 1) {
+        return frame.client->send_msg(frame.payload.data() + ENTRY_HEADER_SIZE,
+                                      frame.payload.size() - ENTRY_HEADER_SIZE, frame.priority);
+    }
+
+    Flatbuffers::MPIMessageBuilder builder;
+    const auto [buffer, size] = builder.build_mpi_message(
+        Messaging::MessageType_AGGREGATE, PC_MODULE_ID, 0, 0, frame.durable, 0, frame.payload,
+        priority_flags(frame.priority));
+    return frame.client->send_msg(buffer, size, frame.priority);
+}
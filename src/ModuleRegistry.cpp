@@ -0,0 +1,173 @@
+#include "ModuleRegistry.h"
+
+#include <array>
+
+#undef min
+#include <algorithm>
+
+constexpr auto UNANSWERED_QUERY_LIMIT = 2;
+constexpr auto UNANSWERED_QUERY_TIMEOUT = std::chrono::seconds(10);
+constexpr std::array REFRESH_POINTS{0.80, 0.85, 0.90, 0.95}; // fractions of the TTL
+constexpr auto REFRESH_JITTER = 0.02;
+
+std::optional<ModuleChange>
+ModuleRegistry::update(const mDNSRobotModule &module, const std::chrono::seconds ttl,
+                       const std::string_view instance,
+                       const std::optional<std::chrono::seconds> ptr_ttl,
+                       const Clock::time_point now) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_entries.find(module.id);
+
+    // A TTL of zero is a goodbye packet, the module is going away.
+    if (ttl.count() == 0) {
+        if (it == m_entries.end()) {
+            return std::nullopt;
+        }
+        auto removed = std::move(it->second.module);
+        m_entries.erase(it);
+        return ModuleChange{ModuleEvent::Removed, std::move(removed)};
+    }
+
+    const bool added = it == m_entries.end();
+    auto &entry = added ? m_entries[module.id] : it->second;
+    entry.ttl = ttl;
+    entry.last_seen = now;
+    entry.unanswered_queries = 0;
+    entry.refreshes = 0;
+    entry.refresh_jitter = random_jitter();
+    if (!instance.empty()) {
+        entry.instance = instance; // announcements do not always carry the PTR record
+    }
+    if (ptr_ttl) {
+        entry.ptr_ttl = *ptr_ttl;
+        entry.ptr_seen = now;
+    }
+
+    if (added) {
+        entry.module = module;
+        return ModuleChange{ModuleEvent::Added, module};
+    }
+
+    if (entry.module == module) {
+        return std::nullopt;
+    }
+
+    entry.module = module;
+    return ModuleChange{ModuleEvent::Updated, module};
+}
+
+std::optional<mDNSRobotModule> ModuleRegistry::remove(const uint8_t id) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        return std::nullopt;
+    }
+
+    auto removed = std::move(it->second.module);
+    m_entries.erase(it);
+    return removed;
+}
+
+std::vector<mDNSRobotModule> ModuleRegistry::expire(const Clock::time_point now) {
+    std::scoped_lock lock(m_mutex);
+    std::vector<mDNSRobotModule> expired;
+
+    for (auto it = m_entries.begin(); it != m_entries.end();) {
+        const auto &entry = it->second;
+        const bool ttl_expired = now - entry.last_seen >= entry.ttl;
+        const bool stopped_answering = entry.unanswered_queries >= UNANSWERED_QUERY_LIMIT &&
+                                       now - entry.last_seen >= UNANSWERED_QUERY_TIMEOUT;
+
+        if (ttl_expired || stopped_answering) {
+            expired.push_back(std::move(it->second.module));
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    return expired;
+}
+
+std::vector<KnownAnswer> ModuleRegistry::record_query(const Clock::time_point now) {
+    std::scoped_lock lock(m_mutex);
+    std::vector<KnownAnswer> known_answers;
+
+    for (auto &[_, entry] : m_entries) {
+        // This query counts as every refresh that has come due, however late it is.
+        for (auto due = refresh_time(entry); due && *due <= now; due = refresh_time(entry)) {
+            entry.refreshes++;
+        }
+
+        // Only list PTR records with more than half their TTL left, a responder answers anyway
+        // when the listed TTL is less than half its own (RFC 6762 7.1). Modules being refreshed
+        // are left out, so they answer with fresh A and TXT records.
+        const auto remaining = entry.ptr_ttl - std::chrono::duration_cast<std::chrono::seconds>(
+                                                   now - entry.ptr_seen);
+        if (!entry.instance.empty() && entry.refreshes == 0 && remaining > entry.ptr_ttl / 2) {
+            known_answers.push_back({entry.instance, remaining});
+            continue;
+        }
+
+        // Only count queries sent after the module last answered.
+        if (now > entry.last_seen) {
+            entry.unanswered_queries++;
+        }
+    }
+
+    return known_answers;
+}
+
+std::optional<ModuleRegistry::Clock::time_point> ModuleRegistry::next_refresh() const {
+    std::scoped_lock lock(m_mutex);
+    std::optional<Clock::time_point> next;
+    for (const auto &[_, entry] : m_entries) {
+        if (const auto due = refresh_time(entry)) {
+            next = std::min(next.value_or(*due), *due);
+        }
+    }
+    return next;
+}
+
+std::optional<std::chrono::seconds> ModuleRegistry::shortest_ttl() const {
+    std::scoped_lock lock(m_mutex);
+    std::optional<std::chrono::seconds> shortest;
+    for (const auto &[_, entry] : m_entries) {
+        shortest = std::min(shortest.value_or(entry.ttl), entry.ttl);
+    }
+    return shortest;
+}
+
+// When the next refresh query for entry is due, nullopt once all of them have been sent.
+std::optional<ModuleRegistry::Clock::time_point>
+ModuleRegistry::refresh_time(const Entry &entry) {
+    if (entry.refreshes >= REFRESH_POINTS.size()) {
+        return std::nullopt;
+    }
+    const auto fraction = REFRESH_POINTS[entry.refreshes] + entry.refresh_jitter;
+    return entry.last_seen + std::chrono::duration_cast<Clock::duration>(
+                                 std::chrono::duration<double>(entry.ttl) * fraction);
+}
+
+// Must be called with m_mutex held.
+double ModuleRegistry::random_jitter() {
+    return std::uniform_real_distribution(0.0, REFRESH_JITTER)(m_random);
+}
+
+std::unordered_map<uint8_t, mDNSRobotModule> ModuleRegistry::modules() const {
+    std::scoped_lock lock(m_mutex);
+    std::unordered_map<uint8_t, mDNSRobotModule> modules;
+    for (const auto &[id, entry] : m_entries) {
+        modules.insert({id, entry.module});
+    }
+    return modules;
+}
+
+std::unordered_set<uint8_t> ModuleRegistry::ids() const {
+    std::scoped_lock lock(m_mutex);
+    std::unordered_set<uint8_t> ids;
+    for (const auto &[id, _] : m_entries) {
+        ids.insert(id);
+    }
+    return ids;
+}
@@ -0,0 +1,47 @@
+#include "ModuleStateCache.h"
+
+void ModuleStateCache::update(const RobotModule &module,
+                              const std::chrono::steady_clock::time_point received) {
+    auto &slot = m_slots[module.id()];
+    const auto motor_state = module.configuration_as_MotorState();
+
+    const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+    slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.module_type.store(module.module_type(), std::memory_order_relaxed);
+    slot.configuration_type.store(module.configuration_type(), std::memory_order_relaxed);
+    slot.angle.store(motor_state ? motor_state->angle() : 0, std::memory_order_relaxed);
+    slot.received.store(received.time_since_epoch().count(), std::memory_order_relaxed);
+
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+std::optional<ModuleStateSnapshot> ModuleStateCache::get(const uint8_t id) const {
+    const auto &slot = m_slots[id];
+
+    while (true) {
+        const auto before = slot.sequence.load(std::memory_order_acquire);
+        if (before == 0) {
+            return std::nullopt; // never received
+        }
+        if (before & 1) {
+            continue; // mid update, the writer only holds it for a few stores
+        }
+
+        const ModuleStateSnapshot snapshot{
+            id,
+            static_cast<ModuleType>(slot.module_type.load(std::memory_order_relaxed)),
+            static_cast<ModuleState>(slot.configuration_type.load(std::memory_order_relaxed)),
+            slot.angle.load(std::memory_order_relaxed),
+            before / 2,
+            std::chrono::steady_clock::time_point(
+                std::chrono::steady_clock::duration(slot.received.load(std::memory_order_relaxed))),
+        };
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) == before) {
+            return snapshot;
+        }
+    }
+}
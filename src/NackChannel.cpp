@@ -0,0 +1,270 @@
+#include "NackChannel.h"
+#include "ReplayBuffer.h"
+
+#include <optional>
+
+#undef min
+#undef max
+#include <algorithm>
+
+NackChannel::NackChannel(ResendFunction resend, NackFunction send_nack,
+                         RetryInterval retry_interval)
+    : m_resend(std::move(resend)), m_send_nack(std::move(send_nack)),
+      m_retry_interval(std::move(retry_interval)), m_stop_flag(false),
+      m_thread(std::thread(&NackChannel::retry_thread, this)) {
+}
+
+NackChannel::~NackChannel() {
+    {
+        std::scoped_lock lock(m_mutex);
+        m_stop_flag = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+// Never 0, which marks a message without a sequence number.
+uint16_t NackChannel::next_sequence(const uint8_t destination) {
+    std::scoped_lock lock(m_mutex);
+    auto &next = m_outgoing[destination].next;
+    if (++next == 0) {
+        ++next;
+    }
+    return next;
+}
+
+void NackChannel::sent(const uint8_t destination, const uint16_t sequence, const uint8_t *frame,
+                       const size_t size, const Clock::time_point deadline) {
+    {
+        std::scoped_lock lock(m_mutex);
+        const auto now = Clock::now();
+        auto &outgoing = m_outgoing[destination];
+        if (outgoing.sent.size() >= NACK_BUFFER_SIZE) {
+            if (outgoing.sent.front().deadline > now) {
+                m_stats[destination].evicted++;
+            }
+            outgoing.sent.pop_front();
+        }
+        outgoing.sent.push_back({sequence, {frame, frame + size}, deadline});
+        if (outgoing.newest == 0 || sequence_before(outgoing.newest, sequence)) {
+            outgoing.newest = sequence;
+        }
+        outgoing.last_sent = now;
+    }
+    m_cond.notify_one(); // a new deadline, and a newest number to announce
+}
+
+// Marks everything from the newest received up to end, exclusive, as missing. Returns the
+// numbers to NACK right away.
+std::vector<uint16_t> NackChannel::add_gaps(Incoming &incoming, NackStats &stats,
+                                            const uint16_t end, const Clock::time_point now) {
+    std::vector<uint16_t> gaps;
+    const auto gap = static_cast<uint16_t>(end - incoming.newest - 1);
+    auto sequence = static_cast<uint16_t>(incoming.newest + 1);
+    if (gap > NACK_MAX_MISSING) {
+        stats.unrecovered += gap - NACK_MAX_MISSING;
+        sequence = static_cast<uint16_t>(end - NACK_MAX_MISSING);
+    }
+
+    for (; sequence != end; sequence++) {
+        if (sequence != 0) {
+            incoming.missing.insert_or_assign(sequence, Missing{now, 1});
+            gaps.push_back(sequence);
+        }
+    }
+
+    // Give up on the gaps furthest behind once too many are open.
+    while (incoming.missing.size() > NACK_MAX_MISSING) {
+        const auto oldest = std::ranges::max_element(incoming.missing, {}, [&](const auto &entry) {
+            return static_cast<uint16_t>(incoming.newest - entry.first);
+        });
+        incoming.missing.erase(oldest);
+        stats.unrecovered++;
+    }
+    return gaps;
+}
+
+bool NackChannel::received(const uint8_t sender, const uint16_t sequence,
+                           const uint32_t session) {
+    std::vector<uint16_t> gaps;
+    uint16_t newest_sent = 0;
+    {
+        std::scoped_lock lock(m_mutex);
+        auto &incoming = m_incoming[sender];
+        auto &stats = m_stats[sender];
+        const auto distance = static_cast<int16_t>(sequence - incoming.newest);
+
+        // First message, or the sender restarted its numbering.
+        if (!incoming.started || session != incoming.session) {
+            incoming = Incoming{true, session, sequence, {}};
+            return true;
+        }
+        if (distance == 0) {
+            return false;
+        }
+        if (distance < 0) {
+            const auto it = incoming.missing.find(sequence);
+            if (it == incoming.missing.end()) {
+                return false; // a duplicate, or a gap we gave up on
+            }
+            incoming.missing.erase(it);
+            stats.recovered++;
+            return true;
+        }
+
+        gaps = add_gaps(incoming, stats, sequence, Clock::now());
+        incoming.newest = sequence;
+        if (!gaps.empty()) {
+            stats.nacks_sent++;
+            newest_sent = m_outgoing[sender].newest;
+        }
+    }
+
+    if (!gaps.empty()) {
+        m_cond.notify_one(); // new gaps to NACK again
+        m_send_nack(sender, newest_sent, gaps);
+    }
+    return true;
+}
+
+void NackChannel::on_nack(const uint8_t sender, const uint16_t newest_sent,
+                          const std::vector<uint16_t> &missing, const uint32_t session) {
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<uint16_t> gaps;
+    uint16_t our_newest = 0;
+    {
+        std::scoped_lock lock(m_mutex);
+        const auto now = Clock::now();
+        auto &outgoing = m_outgoing[sender];
+        auto &stats = m_stats[sender];
+
+        for (const auto sequence : missing) {
+            const auto it = std::ranges::find(outgoing.sent, sequence, &Sent::sequence);
+            if (it == outgoing.sent.end() || it->deadline <= now ||
+                it->retransmits >= NACK_MAX_RETRANSMITS) {
+                stats.expired++;
+                continue;
+            }
+            it->retransmits++;
+            frames.push_back(it->frame);
+            stats.retransmitted++;
+        }
+
+        // The sender may have sent us more than we have seen. If it restarted, what we have
+        // seen is from before, and its next message starts over.
+        auto &incoming = m_incoming[sender];
+        if (incoming.started && session != incoming.session) {
+            incoming = Incoming{};
+        }
+        if (newest_sent != 0 && incoming.started) {
+            const auto distance = static_cast<int16_t>(newest_sent - incoming.newest);
+            if (distance > 0) {
+                gaps = add_gaps(incoming, stats, static_cast<uint16_t>(newest_sent + 1), now);
+                incoming.newest = newest_sent;
+            }
+        }
+        if (!gaps.empty()) {
+            stats.nacks_sent++;
+            our_newest = outgoing.newest;
+        }
+    }
+
+    for (auto &frame : frames) {
+        m_resend(sender, frame);
+    }
+    if (!gaps.empty()) {
+        m_cond.notify_one();
+        m_send_nack(sender, our_newest, gaps);
+    }
+}
+
+void NackChannel::reset(const uint8_t sender) {
+    std::scoped_lock lock(m_mutex);
+    m_incoming.erase(sender);
+}
+
+NackStats NackChannel::stats(const uint8_t module) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_stats.find(module);
+    return it == m_stats.end() ? NackStats{} : it->second;
+}
+
+// Drops messages past their deadline, NACKs gaps again once a retry interval has gone by
+// without the retransmission arriving, and announces the newest number to destinations that
+// have not heard from us for a retry interval, so a lost tail gets noticed. Sleeps until the
+// next of those is due, or until there is something new.
+void NackChannel::retry_thread() {
+    struct Nack {
+        uint16_t newest_sent = 0;
+        std::vector<uint16_t> missing;
+    };
+
+    std::unique_lock lock(m_mutex);
+    while (!m_stop_flag) {
+        const auto now = Clock::now();
+        std::optional<Clock::time_point> wake;
+        const auto wake_at = [&wake](const Clock::time_point at) {
+            wake = std::min(wake.value_or(at), at);
+        };
+        std::unordered_map<uint8_t, Nack> nacks;
+
+        for (auto &[module, outgoing] : m_outgoing) {
+            std::erase_if(outgoing.sent, [now](const Sent &sent) { return sent.deadline <= now; });
+            for (const auto &sent : outgoing.sent) {
+                wake_at(sent.deadline);
+            }
+            if (outgoing.sent.empty() || outgoing.announced == outgoing.newest) {
+                continue;
+            }
+            if (const auto due = outgoing.last_sent + m_retry_interval(module); due > now) {
+                wake_at(due);
+            } else {
+                outgoing.announced = outgoing.newest;
+                nacks[module].newest_sent = outgoing.newest;
+            }
+        }
+
+        for (auto &[module, incoming] : m_incoming) {
+            const auto interval = m_retry_interval(module);
+            auto &stats = m_stats[module];
+            std::vector<uint16_t> missing;
+            for (auto it = incoming.missing.begin(); it != incoming.missing.end();) {
+                auto &gap = it->second;
+                if (now - gap.last_nack < interval) {
+                    wake_at(gap.last_nack + interval);
+                    ++it;
+                } else if (gap.attempts >= NACK_MAX_ATTEMPTS) {
+                    stats.unrecovered++;
+                    it = incoming.missing.erase(it);
+                } else {
+                    gap.attempts++;
+                    gap.last_nack = now;
+                    wake_at(now + interval);
+                    missing.push_back(it->first);
+                    ++it;
+                }
+            }
+            if (!missing.empty()) {
+                stats.nacks_sent++;
+                auto &nack = nacks[module];
+                nack.newest_sent = m_outgoing[module].newest;
+                nack.missing = std::move(missing);
+            }
+        }
+
+        if (!nacks.empty()) {
+            lock.unlock();
+            for (const auto &[module, nack] : nacks) {
+                m_send_nack(module, nack.newest_sent, nack.missing);
+            }
+            lock.lock();
+            continue;
+        }
+
+        if (wake) {
+            m_cond.wait_until(lock, *wake);
+        } else {
+            m_cond.wait(lock);
+        }
+    }
+}
@@ -0,0 +1,186 @@
+#include "PacedSender.h"
+
+#undef min
+#undef max
+#include <algorithm>
+
+void TokenBucket::set_limits(const PacingLimits &limits, const Clock::time_point now) {
+    if (m_last_refill == Clock::time_point{}) {
+        // Start full, an idle link may send a burst straight away.
+        m_bytes = limits.burst_bytes;
+        m_messages = std::max(limits.burst_messages, 1.0);
+        m_last_refill = now;
+    } else {
+        refill(now);
+        m_bytes = std::min(m_bytes, limits.burst_bytes);
+        m_messages = std::min(m_messages, std::max(limits.burst_messages, 1.0));
+    }
+    m_limits = limits;
+}
+
+TokenBucket::Clock::duration TokenBucket::wait_time(const size_t size,
+                                                    const Clock::time_point now) {
+    refill(now);
+
+    double seconds = 0;
+    if (m_limits.bytes_per_second > 0) {
+        const auto needed = std::min(static_cast<double>(size), m_limits.burst_bytes) - m_bytes;
+        seconds = std::max(seconds, needed / m_limits.bytes_per_second);
+    }
+    if (m_limits.messages_per_second > 0) {
+        seconds = std::max(seconds, (1.0 - m_messages) / m_limits.messages_per_second);
+    }
+
+    return std::chrono::ceil<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+void TokenBucket::consume(const size_t size) {
+    if (m_limits.bytes_per_second > 0) {
+        m_bytes -= static_cast<double>(size);
+    }
+    if (m_limits.messages_per_second > 0) {
+        m_messages -= 1.0;
+    }
+}
+
+void TokenBucket::refill(const Clock::time_point now) {
+    const auto elapsed = std::chrono::duration<double>(now - m_last_refill).count();
+    m_last_refill = now;
+    if (elapsed <= 0) {
+        return;
+    }
+
+    m_bytes = std::min(m_bytes + elapsed * m_limits.bytes_per_second, m_limits.burst_bytes);
+    m_messages = std::min(m_messages + elapsed * m_limits.messages_per_second,
+                          std::max(m_limits.burst_messages, 1.0));
+}
+
+PacedSender::PacedSender() = default;
+
+PacedSender::~PacedSender() {
+    std::unique_lock lock(m_mutex);
+    auto links = std::move(m_links);
+    m_links.clear();
+    lock.unlock();
+
+    for (auto &[_, link] : links) {
+        stop(std::move(link));
+    }
+}
+
+bool PacedSender::submit(const uint8_t link, const PacingLimits &limits,
+                         std::shared_ptr<ICommunicationClient> client, std::vector<uint8_t> frame,
+                         const MessagePriority priority,
+                         std::optional<std::promise<int>> completion) {
+    std::unique_lock lock(m_mutex);
+    auto &state = m_links[link];
+    if (!state) {
+        state = std::make_unique<Link>();
+        state->thread = std::thread(&PacedSender::send_thread, this, std::ref(*state));
+    }
+    if (state->queue.size() >= PACING_QUEUE_SIZE) {
+        state->stats.rejected++;
+        lock.unlock();
+
+        if (completion) {
+            completion->set_value(-1);
+        }
+        return false;
+    }
+
+    state->bucket.set_limits(limits, Clock::now());
+
+    Pending pending{std::move(client), std::move(frame), priority, std::move(completion)};
+    if (priority == MessagePriority::Critical) {
+        const auto it = std::find_if(state->queue.begin(), state->queue.end(), [](const auto &p) {
+            return p.priority != MessagePriority::Critical;
+        });
+        state->queue.insert(it, std::move(pending));
+    } else {
+        state->queue.push_back(std::move(pending));
+    }
+    state->cond.notify_one();
+    return true;
+}
+
+void PacedSender::remove(const uint8_t link) {
+    std::unique_lock lock(m_mutex);
+    const auto it = m_links.find(link);
+    if (it == m_links.end()) {
+        return;
+    }
+    auto state = std::move(it->second);
+    m_links.erase(it);
+    lock.unlock();
+
+    // Joining the thread, completing promises and dropping clients, none belongs under the lock.
+    stop(std::move(state));
+}
+
+PacingStats PacedSender::stats(const uint8_t link) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_links.find(link);
+    if (it == m_links.end()) {
+        return {};
+    }
+    auto stats = it->second->stats;
+    stats.queued = it->second->queue.size();
+    return stats;
+}
+
+bool PacedSender::busy(const uint8_t link) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_links.find(link);
+    return it != m_links.end() && (it->second->sending || !it->second->queue.empty());
+}
+
+void PacedSender::send_thread(Link &link) {
+    std::unique_lock lock(m_mutex);
+    while (!link.stop) {
+        if (link.queue.empty()) {
+            link.cond.wait(lock);
+            continue;
+        }
+
+        const auto size = link.queue.front().frame.size();
+        if (const auto wait = link.bucket.wait_time(size, Clock::now()); wait.count() > 0) {
+            link.cond.wait_for(lock, wait);
+            continue;
+        }
+        link.bucket.consume(size);
+        link.stats.sent++;
+        auto pending = std::move(link.queue.front());
+        link.queue.pop_front();
+        link.sending = true;
+        lock.unlock();
+
+        const auto result = pending.client->send_msg(
+            pending.frame.data(), static_cast<uint32_t>(pending.frame.size()), pending.priority);
+        if (pending.completion) {
+            pending.completion->set_value(result < 0 ? -1 : 0);
+        }
+
+        lock.lock();
+        link.sending = false;
+    }
+}
+
+// Stops the thread of a link that has been taken out of m_links, then fails its queue. Must be
+// called without m_mutex held.
+void PacedSender::stop(std::unique_ptr<Link> link) {
+    {
+        std::scoped_lock lock(m_mutex);
+        link->stop = true;
+    }
+    link->cond.notify_one();
+    link->thread.join();
+    fail(link->queue);
+}
+void PacedSender::fail(std::deque<Pending> &pending) {
+    for (auto &message : pending) {
+        if (message.completion) {
+            message.completion->set_value(-1);
+        }
+    }
+    pending.clear();
+}
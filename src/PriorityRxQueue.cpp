@@ -0,0 +1,56 @@
+#include "PriorityRxQueue.h"
+#include "flatbuffers_generated/MPIMessage_generated.h"
+#include "spdlog/spdlog.h"
+
+PriorityRxQueue::PriorityRxQueue(const size_t lane_capacity) {
+    for (auto &lane : m_lanes) {
+        lane = std::make_unique<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>>(
+            lane_capacity);
+    }
+}
+
+bool PriorityRxQueue::enqueue(std::unique_ptr<std::vector<uint8_t>> &&message,
+                              const std::chrono::milliseconds max_wait) {
+    flatbuffers::Verifier verifier(message->data(), message->size());
+    if (!Messaging::VerifyMPIMessageBuffer(verifier)) {
+        spdlog::error("[LibRPC] Got invalid flatbuffer data");
+        return true;
+    }
+
+    const auto flags = Messaging::GetMPIMessage(message->data())->flags();
+    const auto lane = priority_lane(message_priority(flags));
+    if (!m_lanes[lane]->enqueue(std::move(message), max_wait)) {
+        return false;
+    }
+
+    {
+        std::scoped_lock lock(m_mutex);
+        m_available++;
+    }
+    m_cond.notify_one();
+    return true;
+}
+
+std::optional<std::unique_ptr<std::vector<uint8_t>>>
+PriorityRxQueue::dequeue(const std::chrono::milliseconds max_wait) {
+    {
+        std::unique_lock lock(m_mutex);
+        if (!m_cond.wait_for(lock, max_wait, [this] { return m_available > 0; })) {
+            return std::nullopt;
+        }
+        m_available--;
+    }
+
+    // Having claimed one, at least one message is in some lane.
+    while (true) {
+        for (const auto &lane : m_lanes) {
+            if (auto message = lane->try_dequeue()) {
+                return message;
+            }
+        }
+    }
+}
+
+QueueStats PriorityRxQueue::stats(const MessagePriority priority) {
+    return m_lanes[priority_lane(priority)]->stats();
+}
@@ -0,0 +1,97 @@
+#include "ReplayBuffer.h"
+
+bool SequenceWindow::accept(const uint16_t sequence, const uint32_t session) {
+    if (sequence == 0) {
+        return true; // unsequenced
+    }
+    if (m_reset.load(std::memory_order_relaxed)) {
+        m_reset.store(false, std::memory_order_relaxed);
+        m_started = false;
+    }
+
+    auto offset = static_cast<int16_t>(sequence - m_base);
+    if (!m_started || session != m_session) {
+        // First message, or the sender restarted its numbering.
+        m_started = true;
+        m_session = session;
+        m_base = sequence;
+        m_received.reset();
+        offset = 0;
+    } else if (offset < 0) {
+        return false; // received, or too far back to tell
+    } else if (offset >= SEQUENCE_WINDOW) {
+        // Too far ahead, the messages in between are not coming. Slide the window up to it.
+        const auto shift = offset - SEQUENCE_WINDOW + 1;
+        m_received >>= shift;
+        m_base = static_cast<uint16_t>(m_base + shift);
+        offset = SEQUENCE_WINDOW - 1;
+    } else if (m_received.test(offset)) {
+        return false;
+    }
+
+    m_received.set(offset);
+    while (m_received.test(0) || m_base == 0) { // 0 is skipped when numbers wrap
+        m_received >>= 1;
+        m_base++;
+    }
+    m_cumulative.store(static_cast<uint16_t>(m_base - 1), std::memory_order_relaxed);
+    return true;
+}
+
+void SequenceWindow::reset() {
+    m_cumulative.store(0, std::memory_order_relaxed);
+    m_reset.store(true, std::memory_order_relaxed);
+}
+
+void ReplayBuffer::record(const uint8_t module, const uint16_t sequence, const uint8_t *frame,
+                          const size_t size) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_modules.find(module);
+    if (it == m_modules.end()) {
+        return;
+    }
+
+    auto &state = it->second;
+    if (state.unacknowledged.size() >= REPLAY_BUFFER_SIZE) {
+        state.unacknowledged.pop_front();
+        state.overflowed++;
+    }
+    state.unacknowledged.push_back({sequence, {frame, frame + size}});
+}
+
+void ReplayBuffer::acknowledge(const uint8_t module, const uint16_t ack) {
+    if (ack == 0) {
+        return;
+    }
+
+    // Concurrent senders may record slightly out of order, so look at every entry.
+    std::scoped_lock lock(m_mutex);
+    std::erase_if(m_modules[module].unacknowledged,
+                  [ack](const Entry &entry) { return !sequence_before(ack, entry.sequence); });
+}
+
+void ReplayBuffer::remove(const uint8_t module) {
+    std::scoped_lock lock(m_mutex);
+    m_modules.erase(module);
+}
+
+std::vector<std::vector<uint8_t>>
+ReplayBuffer::unacknowledged(const std::function<bool(uint8_t)> &filter) {
+    std::scoped_lock lock(m_mutex);
+    std::vector<std::vector<uint8_t>> frames;
+    for (const auto &[module, state] : m_modules) {
+        if (!filter(module)) {
+            continue;
+        }
+        for (const auto &entry : state.unacknowledged) {
+            frames.push_back(entry.frame);
+        }
+    }
+    return frames;
+}
+
+uint64_t ReplayBuffer::overflowed(const uint8_t module) {
+    std::scoped_lock lock(m_mutex);
+    const auto it = m_modules.find(module);
+    return it == m_modules.end() ? 0 : it->second.overflowed;
+}
@@ -0,0 +1,103 @@
+#include <mutex>
+#include <vector>
+
+#include "RoutingTable.h"
+
+// Links without a measurement yet lose ties against measured ones.
+constexpr auto UNKNOWN_RTT = std::chrono::microseconds::max();
+
+RoutingTable::RoutingTable() {
+    m_next_hop.fill(NO_ROUTE);
+}
+
+void RoutingTable::update_module(const mDNSRobotModule &module) {
+    std::unique_lock lock(m_mutex);
+    const auto id = static_cast<uint8_t>(module.id);
+    m_direct.insert(id);
+
+    auto &neighbours = m_advertised[id];
+    neighbours.clear();
+    for (const auto neighbour : module.connected_module_ids) {
+        if (neighbour >= 0 && neighbour <= UINT8_MAX && neighbour != module.id) {
+            neighbours.insert(static_cast<uint8_t>(neighbour));
+        }
+    }
+
+    recompute();
+}
+
+void RoutingTable::remove_module(const uint8_t id) {
+    std::unique_lock lock(m_mutex);
+    m_direct.erase(id);
+    m_advertised.erase(id);
+    m_rtt.erase(id);
+    recompute();
+}
+
+void RoutingTable::set_link_rtt(const uint8_t id, const std::chrono::microseconds rtt) {
+    std::unique_lock lock(m_mutex);
+    m_rtt.insert_or_assign(id, rtt);
+    recompute();
+}
+
+std::optional<uint8_t> RoutingTable::next_hop(const uint8_t destination) const {
+    std::shared_lock lock(m_mutex);
+    const auto hop = m_next_hop[destination];
+    return hop == NO_ROUTE ? std::nullopt : std::optional{static_cast<uint8_t>(hop)};
+}
+
+std::unordered_set<uint8_t> RoutingTable::reachable_modules() const {
+    std::shared_lock lock(m_mutex);
+    std::unordered_set<uint8_t> modules;
+    for (size_t id = 0; id < m_next_hop.size(); id++) {
+        if (m_next_hop[id] != NO_ROUTE) {
+            modules.insert(static_cast<uint8_t>(id));
+        }
+    }
+    return modules;
+}
+
+// Must be called with m_mutex held exclusively. The graph is at most 256 nodes, so a
+// breadth first search per change is cheaper than keeping incremental state in sync.
+void RoutingTable::recompute() {
+    std::array<std::unordered_set<uint8_t>, 256> links;
+    for (const auto &[id, neighbours] : m_advertised) {
+        for (const auto neighbour : neighbours) {
+            links[id].insert(neighbour);
+            links[neighbour].insert(id);
+        }
+    }
+
+    const auto rtt = [this](const int id) {
+        const auto it = m_rtt.find(static_cast<uint8_t>(id));
+        return it == m_rtt.end() ? UNKNOWN_RTT : it->second;
+    };
+
+    std::array<int, 256> distance;
+    distance.fill(NO_ROUTE);
+    m_next_hop.fill(NO_ROUTE);
+
+    // Level by level, so every candidate first hop for a node is seen before it is expanded.
+    std::vector<uint8_t> level(m_direct.begin(), m_direct.end());
+    for (const auto id : level) {
+        distance[id] = 0;
+        m_next_hop[id] = id;
+    }
+
+    for (int depth = 1; !level.empty(); depth++) {
+        std::vector<uint8_t> next_level;
+        for (const auto id : level) {
+            for (const auto neighbour : links[id]) {
+                if (distance[neighbour] == NO_ROUTE) {
+                    distance[neighbour] = depth;
+                    m_next_hop[neighbour] = m_next_hop[id];
+                    next_level.push_back(neighbour);
+                } else if (distance[neighbour] == depth &&
+                           rtt(m_next_hop[id]) < rtt(m_next_hop[neighbour])) {
+                    m_next_hop[neighbour] = m_next_hop[id];
+                }
+            }
+        }
+        level = std::move(next_level);
+    }
+}
@@ -0,0 +1,53 @@
+#include "StaticDiscoveryService.h"
+#include "ClientFactory.h"
+#include "DiscoveryCache.h"
+#include "TCPClient.h"
+#include "UDPClient.h"
+#include "spdlog/spdlog.h"
+
+StaticDiscoveryService::StaticDiscoveryService(const std::vector<mDNSRobotModule> &modules) {
+    for (const auto &module : modules) {
+        m_modules.insert_or_assign(module.id, module);
+    }
+}
+
+StaticDiscoveryService::StaticDiscoveryService(const std::filesystem::path &path)
+    : StaticDiscoveryService(DiscoveryCache::load(path)) {
+    if (m_modules.empty()) {
+        spdlog::warn("[Static] No modules found in {}", path.string());
+    }
+}
+
+std::unordered_set<uint8_t>
+StaticDiscoveryService::find_modules(std::chrono::duration<double> /* wait_time */) {
+    std::unordered_set<uint8_t> modules;
+    for (const auto &[id, _] : m_modules) {
+        modules.insert(id);
+    }
+    return modules;
+}
+
+std::unordered_map<uint8_t, mDNSRobotModule> StaticDiscoveryService::get_modules() {
+    return m_modules;
+}
+
+void StaticDiscoveryService::add_module_callback(ModuleEventCallback callback) {
+    // The set never changes, so the only events are the initial ones.
+    for (const auto &[_, module] : m_modules) {
+        callback(ModuleEvent::Added, module);
+    }
+}
+
+std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
+StaticDiscoveryService::get_lossy_clients(
+    const std::shared_ptr<PriorityRxQueue> &rx_queue,
+    std::vector<uint8_t> &skip_modules) {
+    return create_clients<UDPClient>(m_modules, rx_queue, skip_modules);
+}
+
+std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
+StaticDiscoveryService::get_lossless_clients(
+    const std::shared_ptr<PriorityRxQueue> &rx_queue,
+    std::vector<uint8_t> &skip_modules) {
+    return create_clients<TCPClient>(m_modules, rx_queue, skip_modules);
+}
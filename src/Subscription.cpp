@@ -0,0 +1,37 @@
+#include "Subscription.h"
+
+Subscription::Subscription(Callback callback, Executor executor)
+    : m_callback(std::move(callback)), m_executor(std::move(executor)) {
+}
+
+void Subscription::deliver(std::vector<uint8_t> payload, const uint8_t sender) {
+    if (!m_executor) {
+        m_callback(payload, sender);
+        return;
+    }
+
+    std::unique_lock lock(m_mutex);
+    m_pending.push_back({std::move(payload), sender});
+    if (m_draining) {
+        return; // the task already posted picks this up
+    }
+    m_draining = true;
+    lock.unlock();
+
+    m_executor([self = shared_from_this()] { self->drain(); });
+}
+
+// Only one drain runs at a time, which is what keeps deliveries in order.
+void Subscription::drain() {
+    std::unique_lock lock(m_mutex);
+    while (!m_pending.empty()) {
+        auto message = std::move(m_pending.front());
+        m_pending.pop_front();
+        lock.unlock();
+
+        m_callback(message.payload, message.sender);
+
+        lock.lock();
+    }
+    m_draining = false;
+}
@@ -11,6 +11,7 @@
 #include "constants.h"
 #include "spdlog/spdlog.h"
 #include "util/log.h"
+#include "util/qos.h"
 
 constexpr auto SLEEP_WHILE_INITIALIZING = std::chrono::milliseconds(250);
 constexpr int PORT = 3001;
@@ -19,6 +20,16 @@ constexpr auto RX_SLEEP_ON_ERROR = std::chrono::milliseconds(100);
 constexpr auto SOCKET_TIMEOUT_MS = 2500;
 constexpr int CONNECT_MAX_RETRIES = 5;
 constexpr auto CONNECT_RETRY_DELAY = std::chrono::milliseconds(500);
+constexpr auto RECONNECT_INITIAL_DELAY = std::chrono::milliseconds(100);
+constexpr auto RECONNECT_MAX_DELAY = std::chrono::seconds(5);
+
+#ifdef _WIN32
+constexpr int SEND_FLAGS = 0;
+constexpr int SHUTDOWN_BOTH = SD_BOTH;
+#else
+constexpr int SEND_FLAGS = MSG_NOSIGNAL; // a dropped connection is an error, not SIGPIPE
+constexpr int SHUTDOWN_BOTH = SHUT_RDWR;
+#endif
 
 // todo: - add authentication
 //       - encryption
@@ -30,65 +41,38 @@ TCPClient::~TCPClient() {
 }
 
 int TCPClient::init() {
-    sockaddr_in serv_addr{};
+    m_address.sin_family = AF_INET;
+    m_address.sin_port = htons(PORT);
 
-    if ((this->m_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        spdlog::error("[TCP] Failed to create socket");
-        return -2;
-    }
-
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(PORT);
-
-    if (inet_pton(AF_INET, this->m_ip.c_str(), &serv_addr.sin_addr) <= 0) {
+    if (inet_pton(AF_INET, this->m_ip.c_str(), &m_address.sin_addr) <= 0) {
         spdlog::error("[TCP] Invalid address");
-        deinit();
         return -1;
     }
 
-    timeval timeout{};
-    timeout.tv_sec = SOCKET_TIMEOUT_MS / 1000;
-    timeout.tv_usec = (SOCKET_TIMEOUT_MS % 1000) * 1000;
-
-#ifdef _WIN32
-    setsockopt(this->m_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    setsockopt(this->m_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
-#else
-    setsockopt(this->m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(this->m_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-#endif
-
     bool connected = false;
     for (int attempt = 0; attempt < CONNECT_MAX_RETRIES; ++attempt) {
-        if (attempt > 0) {
-            CLOSE_SOCKET(this->m_socket);
-            if ((this->m_socket = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-                spdlog::error("[TCP] Failed to recreate socket on retry");
-                return -2;
-            }
-#ifdef _WIN32
-            setsockopt(this->m_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-            setsockopt(this->m_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
-#else
-            setsockopt(this->m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-            setsockopt(this->m_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-#endif
+        if ((this->m_socket = open_socket()) < 0) {
+            spdlog::error("[TCP] Failed to create socket");
+            return -2;
         }
 
-        if (connect(this->m_socket, reinterpret_cast<sockaddr *>(&serv_addr), sizeof(serv_addr)) ==
-            0) {
+        if (connect_socket(this->m_socket)) {
             connected = true;
             break;
         }
         spdlog::warn("[TCP] Connection attempt {}/{} failed, retrying...", attempt + 1,
                      CONNECT_MAX_RETRIES);
         print_errno();
+        CLOSE_SOCKET(this->m_socket);
+        this->m_socket = -1;
         std::this_thread::sleep_for(CONNECT_RETRY_DELAY);
     }
 
+    // From here on the rx thread keeps the connection up, even if it never came up.
+    this->m_init_done = true;
+
     if (!connected) {
         spdlog::error("[TCP] Connection failed to connect after {} attempts", CONNECT_MAX_RETRIES);
-        deinit();
         return -1;
     }
 
@@ -104,43 +88,152 @@ void TCPClient::deinit() {
     }
 }
 
+socket_t TCPClient::open_socket() const {
+    const socket_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        return sock;
+    }
+
+    timeval timeout{};
+    timeout.tv_sec = SOCKET_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (SOCKET_TIMEOUT_MS % 1000) * 1000;
+
+#ifdef _WIN32
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+#else
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#endif
+
+    // Every durable message shares this stream, so it carries the normal class.
+    set_socket_priority(sock, MessagePriority::Normal);
+    return sock;
+}
+
+bool TCPClient::connect_socket(const socket_t sock) const {
+    return connect(sock, reinterpret_cast<const sockaddr *>(&m_address), sizeof(m_address)) == 0;
+}
+
 int TCPClient::send_msg(void *sendbuff, const uint32_t len) {
+    std::scoped_lock lock(m_send_mutex);
     if (!m_initialized) {
         return -1;
     }
+    return write_frame(sendbuff, len);
+}
+
+void TCPClient::set_replay_source(ReplaySource source) {
+    std::scoped_lock lock(m_send_mutex);
+    m_replay_source = std::move(source);
+}
+
+// Shuts the socket down rather than closing it, the rx thread still reads from it. Its read
+// then fails and it reconnects as for any lost connection.
+void TCPClient::drop_connection() {
+    std::scoped_lock lock(m_send_mutex);
+    if (m_initialized) {
+        shutdown(m_socket, SHUTDOWN_BOTH);
+    }
+}
 
-    if (send(this->m_socket, (char *)&len, 4, 0) < 4) {
+// Must be called with m_send_mutex held.
+int TCPClient::write_frame(const void *buffer, const uint32_t len) const {
+    if (send(this->m_socket, (const char *)&len, 4, SEND_FLAGS) < 4) {
         return -1;
     }
+    return send(this->m_socket, (const char *)buffer, len, SEND_FLAGS);
+}
 
-    return send(this->m_socket, (char *)sendbuff, len, 0);
+void TCPClient::connection_lost() {
+    spdlog::warn("[TCP] Lost connection to {}, reconnecting", m_ip);
+    std::scoped_lock lock(m_send_mutex);
+    deinit();
 }
 
-void TCPClient::rx_thread() const {
+// Dials until connected or stopped, backing off exponentially. Before anyone else may send,
+// the replay source's frames go out first, so messages lost with the old connection arrive
+// ahead of newer ones.
+void TCPClient::reconnect() {
+    auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(RECONNECT_INITIAL_DELAY);
+    while (!m_stop_flag) {
+        const auto sock = open_socket();
+        if (sock >= 0 && connect_socket(sock)) {
+            std::scoped_lock lock(m_send_mutex);
+            m_socket = sock;
+            std::vector<std::vector<uint8_t>> frames;
+            if (m_replay_source) {
+                frames = m_replay_source();
+            }
+            for (const auto &frame : frames) {
+                write_frame(frame.data(), static_cast<uint32_t>(frame.size()));
+            }
+            spdlog::info("[TCP] Reconnected to {}, replayed {} messages", m_ip, frames.size());
+            m_initialized = true;
+            return;
+        }
+        if (sock >= 0) {
+            CLOSE_SOCKET(sock);
+        }
+
+        // Sleep in short steps, so stopping is not held up by a long backoff.
+        const auto retry_at = std::chrono::steady_clock::now() + delay;
+        while (!m_stop_flag && std::chrono::steady_clock::now() < retry_at) {
+            std::this_thread::sleep_for(std::min<std::chrono::milliseconds>(
+                RX_SLEEP_ON_ERROR, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                       retry_at - std::chrono::steady_clock::now())));
+        }
+        delay = std::min<std::chrono::milliseconds>(delay * 2, RECONNECT_MAX_DELAY);
+    }
+}
+
+static bool timed_out() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAETIMEDOUT;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+void TCPClient::rx_thread() {
     while (!m_stop_flag) {
         if (!m_initialized) {
-            std::this_thread::sleep_for(SLEEP_WHILE_INITIALIZING);
+            if (m_init_done) {
+                reconnect();
+            } else {
+                std::this_thread::sleep_for(SLEEP_WHILE_INITIALIZING);
+            }
             continue;
         }
 
+        // A timeout only means the module had nothing to say. A closed stream, an error, or a
+        // length cut short all mean the connection is gone, and with it the framing.
         uint32_t data_len = 0;
-        if (recv(this->m_socket, (char *)&data_len, 4, MSG_WAITALL) < 0) {
-            std::this_thread::sleep_for(RX_SLEEP_ON_ERROR);
+        const auto header = recv(this->m_socket, (char *)&data_len, 4, MSG_WAITALL);
+        if (header < 0 && timed_out()) {
+            continue;
+        }
+        if (header != 4) {
+            connection_lost();
             continue;
         }
 
         if (data_len > MAX_BUFFER_SIZE || data_len < 1) {
-            std::this_thread::sleep_for(RX_SLEEP_ON_ERROR);
+            spdlog::error("[TCP] Got a frame of {} bytes from {}, resynchronising", data_len,
+                          m_ip);
+            connection_lost();
             continue;
         }
 
         auto buffer = std::make_unique<std::vector<uint8_t>>();
         buffer->resize(MAX_BUFFER_SIZE);
         if (const auto read = recv(this->m_socket, (char *)buffer->data(), data_len, MSG_WAITALL);
-            read > 0) {
-            m_rx_queue->enqueue(std::move(buffer), QUEUE_ADD_TIMEOUT);
+            read == static_cast<decltype(read)>(data_len)) {
+            if (!m_rx_queue->enqueue(std::move(buffer), QUEUE_ADD_TIMEOUT)) {
+                spdlog::warn("[TCP] Receive queue full, dropped a message from {}", m_ip);
+            }
         } else {
-            std::this_thread::sleep_for(RX_SLEEP_ON_ERROR);
+            connection_lost();
         }
     }
 }
@@ -10,6 +10,7 @@
 #include "UDPClient.h"
 #include "spdlog/spdlog.h"
 #include "util/log.h"
+#include "util/qos.h"
 
 constexpr auto SLEEP_WHILE_INITIALIZING = std::chrono::milliseconds(250);
 constexpr int TX_PORT = 3101;
@@ -37,23 +38,32 @@ int UDPClient::init() {
         return -2;
     }
 
-    if ((this->m_tx_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    // Critical messages get a TX socket of their own, so they can be marked differently.
+    if ((this->m_tx_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ||
+        (this->m_critical_tx_socket = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         spdlog::error("[UDP] Failed to create socket");
         print_errno();
         deinit();
         return -2;
     }
+    const socket_t tx_sockets[] = {m_tx_socket, m_critical_tx_socket};
 
     constexpr int opt = 1;
 #ifdef _WIN32
     setsockopt(m_rx_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt));
-    setsockopt(m_tx_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt));
+    for (const auto tx_socket : tx_sockets) {
+        setsockopt(tx_socket, SOL_SOCKET, SO_REUSEADDR, (char *)&opt, sizeof(opt));
+    }
 #else
     setsockopt(m_rx_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
     setsockopt(m_rx_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
-    setsockopt(m_tx_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-    setsockopt(m_tx_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    for (const auto tx_socket : tx_sockets) {
+        setsockopt(tx_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        setsockopt(tx_socket, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
 #endif
+    set_socket_priority(m_tx_socket, MessagePriority::Normal);
+    set_socket_priority(m_critical_tx_socket, MessagePriority::Critical);
 
     timeval timeout{};
     timeout.tv_sec = SOCKET_TIMEOUT_MS / 1000;
@@ -61,10 +71,14 @@ int UDPClient::init() {
 
 #ifdef _WIN32
     setsockopt(this->m_rx_socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    setsockopt(this->m_tx_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+    for (const auto tx_socket : tx_sockets) {
+        setsockopt(tx_socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+    }
 #else
     setsockopt(this->m_rx_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-    setsockopt(this->m_tx_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    for (const auto tx_socket : tx_sockets) {
+        setsockopt(tx_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    }
 #endif
 
     sockaddr_in server_addr = {
@@ -108,20 +122,22 @@ int UDPClient::init() {
 
     in_addr tx_iface{};
     tx_iface.s_addr = mreq.imr_interface.s_addr;
-    if (setsockopt(m_tx_socket, IPPROTO_IP, IP_MULTICAST_IF, (char *)&tx_iface, sizeof(tx_iface)) <
-        0) {
-        spdlog::error("[UDP] Failed to set multicast TX interface");
-        print_errno();
-        deinit();
-        return -1;
-    }
+    for (const auto tx_socket : tx_sockets) {
+        if (setsockopt(tx_socket, IPPROTO_IP, IP_MULTICAST_IF, (char *)&tx_iface,
+                       sizeof(tx_iface)) < 0) {
+            spdlog::error("[UDP] Failed to set multicast TX interface");
+            print_errno();
+            deinit();
+            return -1;
+        }
 
-    // Set multicast TTL > 1 so packets leave the local subnet if needed (default is 1).
-    constexpr int mcast_ttl = 32;
-    if (setsockopt(m_tx_socket, IPPROTO_IP, IP_MULTICAST_TTL, (char *)&mcast_ttl,
-                   sizeof(mcast_ttl)) < 0) {
-        spdlog::warn("[UDP] Failed to set multicast TTL");
-        print_errno();
+        // Set multicast TTL > 1 so packets leave the local subnet if needed (default is 1).
+        constexpr int mcast_ttl = 32;
+        if (setsockopt(tx_socket, IPPROTO_IP, IP_MULTICAST_TTL, (char *)&mcast_ttl,
+                       sizeof(mcast_ttl)) < 0) {
+            spdlog::warn("[UDP] Failed to set multicast TTL");
+            print_errno();
+        }
     }
 #else
     if (setsockopt(m_rx_socket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
@@ -133,23 +149,26 @@ int UDPClient::init() {
 
     in_addr tx_iface{};
     tx_iface.s_addr = mreq.imr_interface.s_addr; // INADDR_ANY lets the OS pick
-    if (setsockopt(m_tx_socket, IPPROTO_IP, IP_MULTICAST_IF, &tx_iface, sizeof(tx_iface)) < 0) {
-        spdlog::error("[UDP] Failed to set multicast TX interface");
-        print_errno();
-        deinit();
-        return -1;
-    }
+    for (const auto tx_socket : tx_sockets) {
+        if (setsockopt(tx_socket, IPPROTO_IP, IP_MULTICAST_IF, &tx_iface, sizeof(tx_iface)) < 0) {
+            spdlog::error("[UDP] Failed to set multicast TX interface");
+            print_errno();
+            deinit();
+            return -1;
+        }
 
-    constexpr int mcast_ttl = 32;
-    if (setsockopt(m_tx_socket, IPPROTO_IP, IP_MULTICAST_TTL, &mcast_ttl, sizeof(mcast_ttl)) < 0) {
-        spdlog::warn("[UDP] Failed to set multicast TTL");
-        print_errno();
-    }
+        constexpr int mcast_ttl = 32;
+        if (setsockopt(tx_socket, IPPROTO_IP, IP_MULTICAST_TTL, &mcast_ttl, sizeof(mcast_ttl)) <
+            0) {
+            spdlog::warn("[UDP] Failed to set multicast TTL");
+            print_errno();
+        }
 
-    constexpr int loop = 0;
-    if (setsockopt(m_tx_socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
-        spdlog::warn("[UDP] Failed to disable multicast loopback");
-        print_errno();
+        constexpr int loop = 0;
+        if (setsockopt(tx_socket, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+            spdlog::warn("[UDP] Failed to disable multicast loopback");
+            print_errno();
+        }
     }
 #endif
 
@@ -166,6 +185,11 @@ void UDPClient::deinit() {
         this->m_tx_socket = -1;
     }
 
+    if (this->m_critical_tx_socket > 0) {
+        CLOSE_SOCKET(this->m_critical_tx_socket);
+        this->m_critical_tx_socket = -1;
+    }
+
     if (this->m_rx_socket > 0) {
         CLOSE_SOCKET(this->m_rx_socket);
         this->m_rx_socket = -1;
@@ -173,6 +197,10 @@ void UDPClient::deinit() {
 }
 
 int UDPClient::send_msg(void *sendbuff, const uint32_t len) {
+    return send_msg(sendbuff, len, MessagePriority::Normal);
+}
+
+int UDPClient::send_msg(void *sendbuff, const uint32_t len, const MessagePriority priority) {
     if (!m_initialized) {
         return -1;
     }
@@ -188,11 +216,13 @@ int UDPClient::send_msg(void *sendbuff, const uint32_t len) {
     mcast_dest.sin_port = htons(TX_PORT);
     inet_pton(AF_INET, SEND_MCAST.c_str(), &mcast_dest.sin_addr);
 
+    const auto sock = priority == MessagePriority::Critical ? m_critical_tx_socket : m_tx_socket;
+
 #ifdef _WIN32
-    return sendto(m_tx_socket, reinterpret_cast<const char *>(buffer.data()), buffer.size(), 0,
+    return sendto(sock, reinterpret_cast<const char *>(buffer.data()), buffer.size(), 0,
                   reinterpret_cast<sockaddr *>(&mcast_dest), sizeof(mcast_dest));
 #else
-    return static_cast<int>(sendto(m_tx_socket, buffer.data(), buffer.size(), 0,
+    return static_cast<int>(sendto(sock, buffer.data(), buffer.size(), 0,
                                    reinterpret_cast<sockaddr *>(&mcast_dest), sizeof(mcast_dest)));
 #endif
 }
@@ -226,7 +256,9 @@ void UDPClient::rx_thread() const {
 
             buffer->erase(buffer->begin(), buffer->begin() + 4);
             buffer->resize(msg_size);
-            m_rx_queue->enqueue(std::move(buffer), QUEUE_ADD_TIMEOUT);
+            if (!m_rx_queue->enqueue(std::move(buffer), QUEUE_ADD_TIMEOUT)) {
+                spdlog::warn("[UDP] Receive queue full, dropped a message");
+            }
         }
     }
 }
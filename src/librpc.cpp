@@ -3,6 +3,7 @@
 
 #include <cstring>
 #include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
@@ -16,17 +17,102 @@
 #include "flatbuffers/CallBuilder.h"
 #include "flatbuffers/MPIMessageBuilder.h"
 #include "spdlog/spdlog.h"
+#include "util/compression.h"
 
 constexpr auto MAX_RECV_WAIT_TIME = std::chrono::seconds(3);
 constexpr auto PER_TAG_MAX_QUEUE_SIZE = 50;
 constexpr auto MAX_WAIT_TIME_TAG_ENQUEUE = std::chrono::milliseconds(250);
 constexpr auto MAX_WAIT_TIME_RX_THREAD_DEQUEUE = std::chrono::milliseconds(250);
 constexpr auto FN_RETURN_BUFFER_SIZE = 1024;
+constexpr uint8_t BROADCAST_DESTINATION = 0xFF;
+constexpr auto HEARTBEAT_POLL_INTERVAL = std::chrono::milliseconds(100);
+constexpr auto HEARTBEAT_MISSED_LIMIT = 3;
+constexpr auto RPC_TIMEOUT_RTO_MULTIPLE = 4;
+
+// Heartbeat payload: kind, then the sender's steady clock in microseconds, echoed back as is.
+constexpr uint8_t HEARTBEAT_PING = 0;
+constexpr uint8_t HEARTBEAT_PONG = 1;
+constexpr size_t HEARTBEAT_SIZE = 1 + sizeof(int64_t);
+
+// How long to wait for a retransmission before asking again, while the link has no RTT
+// estimate.
+constexpr auto NACK_DEFAULT_RETRY_INTERVAL = std::chrono::milliseconds(50);
+
+MessagingInterface::MessagingInterface(std::unique_ptr<IDiscoveryService> discovery_service,
+                                       std::optional<std::filesystem::path> discovery_cache)
+    : m_lossy_sequences(std::make_unique<std::array<std::atomic<uint16_t>, 256 * 256>>()),
+      m_rx_queue(std::make_shared<PriorityRxQueue>(RX_QUEUE_SIZE)),
+      m_module_event_queue(std::make_unique<BlockingQueue<ModuleChange>>(RX_QUEUE_SIZE)),
+      m_stop_flag(false), m_rx_thread(std::thread(&MessagingInterface::handle_recv, this)),
+      m_fn_rx_thread(std::thread(&MessagingInterface::handle_fn_recv, this)),
+      m_module_event_thread(std::thread(&MessagingInterface::handle_module_events, this)),
+      m_heartbeat_thread(std::thread(&MessagingInterface::handle_heartbeats, this)) {
+#ifdef _WIN32
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+    // Initialization must be after call to WSAStartup
+    if (!discovery_service) {
+        discovery_service = std::make_unique<mDNSDiscoveryService>(std::move(discovery_cache));
+    }
+    m_discovery_service = std::move(discovery_service);
+    m_pacer = std::make_unique<PacedSender>();
+    m_nack_channel = std::make_unique<NackChannel>(
+        [this](const uint8_t module, std::vector<uint8_t> &frame) {
+            // Retransmissions are paced like the messages they repair.
+            std::shared_lock lock(m_client_mutex);
+            const auto client = client_for(module, false);
+            const auto hop = m_routing_table.next_hop(module);
+            if (client && hop) {
+                const auto flags =
+                    Flatbuffers::MPIMessageBuilder::parse_mpi_message(frame.data())->flags();
+                const auto *limits = pacing_limits(*hop);
+                m_pacer->submit(*hop, limits ? *limits : PacingLimits{}, client, std::move(frame),
+                                message_priority(flags), std::nullopt);
+            }
+        },
+        [this](const uint8_t module, const uint16_t newest_sent,
+               const std::vector<uint16_t> &missing) { send_nack(module, newest_sent, missing); },
+        [this](const uint8_t module) -> std::chrono::microseconds {
+            const auto estimate = m_link_monitor.estimate(module);
+            return estimate ? estimate->rto : NACK_DEFAULT_RETRY_INTERVAL;
+        });
+    m_conflating_sender = std::make_unique<ConflatingSender>(
+        [this](const uint8_t destination, const uint8_t tag, const bool durable,
+               std::vector<uint8_t> &payload) {
+            return send(payload.data(), payload.size(), destination, tag, durable);
+        });
+    m_discovery_service->add_module_callback(
+        [this](const ModuleEvent event, const mDNSRobotModule &module) {
+            if (!m_module_event_queue->enqueue({event, module}, MODULE_EVENT_ENQUEUE_TIMEOUT)) {
+                spdlog::warn("[LibRPC] Module event queue full, dropped an event for module {}",
+                             module.id);
+            }
+        });
+}
 
 MessagingInterface::~MessagingInterface() {
+    // Its thread sends through this interface.
+    m_conflating_sender.reset();
+
     m_stop_flag = true;
     m_rx_thread.join();
     m_fn_rx_thread.join();
+    m_module_event_thread.join();
+    m_heartbeat_thread.join();
+
+    // Clients reconnect on their own threads, which must stop calling back into us before the
+    // pacer and credit gate their replays go through are gone.
+    for (const auto &[_, client] : m_id_to_lossless_client) {
+        client->set_replay_source(nullptr);
+    }
+
+    m_nack_channel.reset();
+    // Messages held for credits and retransmissions go into the pacer, from the threads above.
+    m_pacer.reset();
+
+    // Stop discovery before the event queue its callbacks feed goes away.
+    m_discovery_service.reset();
 
 #ifdef _WIN32
     WSACleanup();
@@ -35,61 +121,678 @@ MessagingInterface::~MessagingInterface() {
 
 int MessagingInterface::send(uint8_t *buffer, const size_t size, const uint8_t destination,
                              const uint8_t tag, const bool durable) {
-    if (!this->m_id_to_lossless_client.contains(destination)) {
+    std::optional<std::promise<int>> completion;
+    return send_message(buffer, size, destination, tag, durable, std::nullopt, completion);
+}
+
+int MessagingInterface::send(uint8_t *buffer, const size_t size, const uint8_t destination,
+                             const uint8_t tag, const std::chrono::milliseconds deadline) {
+    std::optional<std::promise<int>> completion;
+    return send_message(buffer, size, destination, tag, false, deadline, completion);
+}
+
+std::future<int> MessagingInterface::send_async(uint8_t *buffer, const size_t size,
+                                                const uint8_t destination, const uint8_t tag,
+                                                const bool durable) {
+    std::optional<std::promise<int>> completion(std::in_place);
+    auto result = completion->get_future();
+    const auto sent =
+        send_message(buffer, size, destination, tag, durable, std::nullopt, completion);
+    if (completion) {
+        completion->set_value(sent);
+    }
+    return result;
+}
+
+// Sends straight away or hands the message to the pacer or aggregator, or holds it until the
+// destination grants credits. A message queued with the pacer or held takes completion along
+// and resets it, otherwise the caller completes it. A lossy message with a deadline is kept
+// for retransmission until then.
+int MessagingInterface::send_message(uint8_t *buffer, const size_t size,
+                                     const uint8_t destination, const uint8_t tag,
+                                     const bool durable,
+                                     const std::optional<std::chrono::milliseconds> deadline,
+                                     std::optional<std::promise<int>> &completion) {
+    std::shared_lock lock(m_client_mutex);
+    const auto client = client_for(destination, durable);
+    if (!client) {
         return -1;
     }
 
+    uint8_t flags = 0;
+    const auto payload =
+        encode_payload(buffer, size, tag, m_accepts_compression.contains(destination), flags);
+    uint16_t sequence = 0;
+    if (durable) {
+        sequence = next_sequence(destination);
+    } else if (deadline) {
+        flags |= Flatbuffers::MPI_FLAG_RELIABLE;
+        sequence = m_nack_channel->next_sequence(destination);
+    } else {
+        sequence = next_lossy_sequence(destination, tag);
+    }
+
+    Flatbuffers::MPIMessageBuilder builder;
+    const auto [mpi_buffer, mpi_size] = builder.build_mpi_message(
+        Messaging::MessageType_PTP, PC_MODULE_ID, destination, sequence, durable, tag, payload,
+        flags, m_received_sequences[destination].cumulative());
+
+    const auto priority = message_priority(flags);
+    const auto *data = static_cast<uint8_t *>(mpi_buffer);
+    if (deadline) {
+        m_nack_channel->sent(destination, sequence, data, mpi_size,
+                             std::chrono::steady_clock::now() + *deadline);
+    }
+
+    // Limits are those of the module at the other end of the link, the first hop.
+    const auto hop = m_routing_table.next_hop(destination);
+    std::optional<std::pair<uint8_t, PacingLimits>> pacing;
+    if (const auto *limits = hop ? pacing_limits(*hop) : nullptr) {
+        pacing.emplace(*hop, *limits);
+    }
+
+    if (durable) {
+        const auto credit = acquire_durable(hop.value_or(destination), client, destination,
+                                            sequence, priority, data, mpi_size, completion);
+        if (credit == CreditResult::Exhausted) {
+            return -1;
+        }
+        if (credit == CreditResult::Held) {
+            return 0;
+        }
+    }
+
+    // A recorded durable message goes out again once the connection is back, so a failed write
+    // still counts as sent. Reporting it would have callers resend it, delivering it twice.
+    const int failed = durable ? 0 : -1;
+    if (pacing) {
+        const bool queued = m_pacer->submit(pacing->first, pacing->second, client,
+                                            {data, data + mpi_size}, priority,
+                                            std::move(completion));
+        completion.reset();
+        return queued ? 0 : failed;
+    }
+
+    // Critical messages go out straight away rather than wait for a frame to fill.
+    if (m_aggregator && priority != MessagePriority::Critical) {
+        return m_aggregator->enqueue(client, durable, priority,
+                                     static_cast<uint8_t *>(mpi_buffer), mpi_size) < 0
+                   ? failed
+                   : 0;
+    }
+
+    // A caller with a completion does not wait for the write, the link's sender does it. Sends
+    // made while that sender is busy queue behind it, so they cannot overtake earlier ones.
+    if (hop && (completion || m_pacer->busy(*hop))) {
+        std::optional<std::future<int>> sent;
+        if (!completion) {
+            sent = completion.emplace().get_future();
+        }
+        const bool queued = m_pacer->submit(*hop, PacingLimits{}, client, {data, data + mpi_size},
+                                            priority, std::move(completion));
+        completion.reset();
+        if (!queued || (sent && sent->get() < 0)) {
+            return failed;
+        }
+        return 0;
+    }
+
+    return client->send_msg(mpi_buffer, mpi_size, priority) < 0 ? failed : 0;
+}
+
+int MessagingInterface::send_latest(uint8_t *buffer, const size_t size, const uint8_t destination,
+                                    const uint8_t tag, const bool durable) {
+    {
+        std::shared_lock lock(m_client_mutex);
+        if (!client_for(destination, durable)) {
+            return -1;
+        }
+    }
+
+    m_conflating_sender->submit(destination, tag, durable, {buffer, buffer + size});
+    return 0;
+}
+
+uint64_t MessagingInterface::replay_overflows(const uint8_t module) {
+    return m_replay_buffer.overflowed(module);
+}
+
+LossStats MessagingInterface::loss_stats(const uint8_t module) {
+    return m_loss_tracker.stats(module);
+}
+
+void MessagingInterface::set_drop_stale(const uint8_t tag, const bool enabled) {
+    m_drop_stale_tags[tag] = enabled;
+}
+
+NackStats MessagingInterface::nack_stats(const uint8_t module) {
+    return m_nack_channel->stats(module);
+}
+
+// The payload of a NACK message is the missing sequence numbers, see NackChannel.h. It goes
+// out as Critical, a retransmission is only useful while the deadline has not passed.
+void MessagingInterface::send_nack(const uint8_t destination, const uint16_t newest_sent,
+                                   const std::vector<uint16_t> &missing) {
+    std::vector<uint8_t> payload(missing.size() * sizeof(uint16_t));
+    std::memcpy(payload.data(), missing.data(), payload.size());
+
+    const auto flags = priority_flags(MessagePriority::Critical);
     Flatbuffers::MPIMessageBuilder builder;
     const auto [mpi_buffer, mpi_size] =
-        builder.build_mpi_message(Messaging::MessageType_PTP, PC_MODULE_ID, destination, 0, durable,
-                                  tag, std::vector<uint8_t>(buffer, buffer + size));
+        builder.build_mpi_message(Messaging::MessageType_NACK, PC_MODULE_ID, destination,
+                                  newest_sent, false, 0, payload, flags);
 
     std::shared_lock lock(m_client_mutex);
-    if (durable) {
-        this->m_id_to_lossless_client[destination]->send_msg(mpi_buffer, mpi_size);
+    if (const auto client = client_for(destination, false)) {
+        client->send_msg(mpi_buffer, mpi_size, MessagePriority::Critical);
+    }
+}
+
+void MessagingInterface::handle_nack(const Messaging::MPIMessage *mpi_message) {
+    const auto payload = mpi_message->payload();
+    const auto size = payload ? payload->size() : 0;
+    if (size % sizeof(uint16_t) != 0) {
+        spdlog::warn("[LibRPC] Got a malformed NACK from {}", mpi_message->sender());
+        return;
+    }
+
+    std::vector<uint16_t> missing(size / sizeof(uint16_t));
+    if (size > 0) {
+        std::memcpy(missing.data(), payload->data(), size);
+    }
+    m_nack_channel->on_nack(mpi_message->sender(), mpi_message->sequence_number(), missing,
+                            mpi_message->session());
+}
+
+uint64_t MessagingInterface::conflated_sends() const {
+    return m_conflating_sender->conflated();
+}
+
+// Must be called with m_client_mutex held.
+std::shared_ptr<ICommunicationClient> MessagingInterface::client_for(const uint8_t destination,
+                                                                    const bool durable) const {
+    const auto hop = m_routing_table.next_hop(destination);
+    if (!hop) {
+        return nullptr;
+    }
+
+    // Only look up under the shared lock, operator[] would insert.
+    const auto &clients = durable ? this->m_id_to_lossless_client : this->m_id_to_lossy_client;
+    const auto it = clients.find(*hop);
+    return it == clients.end() ? nullptr : it->second;
+}
+
+// Must be called with m_client_mutex held exclusively.
+void MessagingInterface::set_accepts_compression(const mDNSRobotModule &module) {
+    if (module.lz_compression) {
+        m_accepts_compression.insert(static_cast<uint8_t>(module.id));
     } else {
-        this->m_id_to_lossy_client[destination]->send_msg(mpi_buffer, mpi_size);
+        m_accepts_compression.erase(static_cast<uint8_t>(module.id));
     }
+}
 
-    return 0;
+// Must be called with m_client_mutex held. nullptr if the link to hop is not paced.
+const PacingLimits *MessagingInterface::pacing_limits(const uint8_t hop) const {
+    const auto type = m_id_to_type.find(hop);
+    if (type == m_id_to_type.end()) {
+        return nullptr;
+    }
+    const auto limits = m_pacing_limits.find(type->second);
+    return limits == m_pacing_limits.end() ? nullptr : &limits->second;
 }
 
-int MessagingInterface::broadcast(uint8_t *buffer, size_t size, bool durable) {
-    return -1; // todo
+// Never 0, which marks a message without a sequence number.
+uint16_t MessagingInterface::next_sequence(const uint8_t destination) {
+    auto sequence = static_cast<uint16_t>(m_next_sequence[destination].fetch_add(1) + 1);
+    if (sequence == 0) {
+        sequence = static_cast<uint16_t>(m_next_sequence[destination].fetch_add(1) + 1);
+    }
+    return sequence;
 }
 
-std::optional<SizeAndSource> MessagingInterface::recv(uint8_t *buffer, const size_t size,
-                                                      uint8_t tag) {
-    std::unique_lock lock(m_tag_queue_mutex);
-    if (!m_tag_to_queue_map.contains(tag)) {
-        m_tag_to_queue_map.insert(
-            {tag, std::make_unique<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>>(
-                      PER_TAG_MAX_QUEUE_SIZE)});
+uint16_t MessagingInterface::next_lossy_sequence(const uint8_t destination, const uint8_t tag) {
+    auto &counter = (*m_lossy_sequences)[destination << 8 | tag];
+    auto sequence = static_cast<uint16_t>(counter.fetch_add(1, std::memory_order_relaxed) + 1);
+    if (sequence == 0) {
+        sequence = static_cast<uint16_t>(counter.fetch_add(1, std::memory_order_relaxed) + 1);
+    }
+    return sequence;
+}
+
+// Unacknowledged durable messages for every destination reached through hop.
+std::vector<std::vector<uint8_t>> MessagingInterface::replay_frames(const uint8_t hop) {
+    return m_replay_buffer.unacknowledged(
+        [this, hop](const uint8_t module) { return m_routing_table.next_hop(module) == hop; });
+}
+
+// The frames to write as soon as the lossless connection to hop is up again. Runs on the
+// client's rx thread with its send lock held, so must not take m_client_mutex. On a flow
+// controlled link the module's window starts over, so the frames are held for its credits
+// like any other durable send, and nothing is written straight away.
+std::vector<std::vector<uint8_t>>
+MessagingInterface::reconnected(const uint8_t hop,
+                                const std::weak_ptr<ICommunicationClient> &link) {
+    auto frames = replay_frames(hop);
+    const auto client = link.lock();
+    if (!client || frames.empty()) {
+        return frames;
+    }
+
+    const bool held = m_credit_gate.reset(hop, [&] {
+        std::vector<CreditGate::Release> replay;
+        replay.reserve(frames.size());
+        for (auto &frame : frames) {
+            replay.emplace_back([this, hop, client, frame = std::move(frame)](const bool send) {
+                if (send) {
+                    send_released(hop, client, frame, MessagePriority::Normal, std::nullopt);
+                }
+            });
+        }
+        return replay;
+    });
+    return held ? std::vector<std::vector<uint8_t>>{} : frames;
+}
+
+// Sends a message the credit gate released, through the pacer like any other. Runs on
+// whichever thread granted the credits, with no lock held.
+void MessagingInterface::send_released(const uint8_t hop,
+                                       std::shared_ptr<ICommunicationClient> client,
+                                       std::vector<uint8_t> frame, const MessagePriority priority,
+                                       std::optional<std::promise<int>> completion) {
+    PacingLimits limits;
+    {
+        std::shared_lock lock(m_client_mutex);
+        if (const auto *paced = pacing_limits(hop)) {
+            limits = *paced;
+        }
+    }
+    m_pacer->submit(hop, limits, std::move(client), std::move(frame), priority,
+                    std::move(completion));
+}
+
+// Takes a credit on link for a durable frame to destination. A durable frame is only recorded
+// for replay once it is actually sent: a granted one straight away, after which the caller
+// sends it, a held one when it is released. A held frame takes completion along and resets it.
+CreditResult MessagingInterface::acquire_durable(
+    const uint8_t link, const std::shared_ptr<ICommunicationClient> &client,
+    const uint8_t destination, const uint16_t sequence, const MessagePriority priority,
+    const uint8_t *data, const size_t size, std::optional<std::promise<int>> &completion) {
+    const auto credit =
+        m_credit_gate.acquire(link, m_credit_policy == CreditPolicy::Hold, [&] {
+            return CreditGate::Release(
+                [this, link, client, destination, sequence, priority,
+                 frame = std::vector(data, data + size),
+                 completion = std::move(completion)](const bool send) mutable {
+                    if (!send) {
+                        if (completion) {
+                            completion->set_value(-1);
+                        }
+                        return;
+                    }
+                    m_replay_buffer.record(destination, sequence, frame.data(), frame.size());
+                    send_released(link, client, std::move(frame), priority,
+                                  std::move(completion));
+                });
+        });
+    if (credit == CreditResult::Held) {
+        completion.reset();
+    } else if (credit == CreditResult::Granted) {
+        m_replay_buffer.record(destination, sequence, data, size);
     }
-    const auto &queue = m_tag_to_queue_map[tag];
+    return credit;
+}
+
+// Applies the settings of tag: its priority class, and compression if enabled, the receivers
+// can decode it and it actually saves something.
+std::vector<uint8_t> MessagingInterface::encode_payload(const uint8_t *buffer, const size_t size,
+                                                        const uint8_t tag, const bool compress,
+                                                        uint8_t &flags) const {
+    flags |= priority_flags(m_tag_priorities[tag]);
+
+    std::vector<uint8_t> payload(buffer, buffer + size);
+    if (compress && m_compressed_tags[tag]) {
+        if (auto compressed = lz_compress(buffer, size);
+            compressed && compressed->size() < payload.size()) {
+            payload = std::move(*compressed);
+            flags |= Flatbuffers::MPI_FLAG_COMPRESSED;
+        }
+    }
+    return payload;
+}
+
+int MessagingInterface::broadcast(uint8_t *buffer, const size_t size, const uint8_t tag,
+                                  const bool durable) {
+    // Snapshot the clients, so sends do not hold up connects and disconnects.
+    struct Link {
+        uint8_t hop;
+        std::shared_ptr<ICommunicationClient> client;
+        PacingLimits limits; // unlimited if the link is not paced
+    };
+    std::shared_lock lock(m_client_mutex);
+    std::vector<Link> links;
+    const auto &client_map = durable ? m_id_to_lossless_client : m_id_to_lossy_client;
+    for (const auto &[hop, client] : client_map) {
+        const auto *limits = pacing_limits(hop);
+        links.push_back({hop, client, limits ? *limits : PacingLimits{}});
+        if (!durable) {
+            break; // every UDP client sends to the same multicast group
+        }
+    }
+    // Every module receives a broadcast, so it is only compressed if all of them can decode it.
+    const bool compress = std::ranges::all_of(m_id_to_ip, [this](const auto &module) {
+        return m_accepts_compression.contains(module.first);
+    });
     lock.unlock();
 
-    const auto data = queue->dequeue(MAX_RECV_WAIT_TIME);
+    if (links.empty()) {
+        return -1;
+    }
 
+    uint8_t flags = 0;
+    const auto payload = encode_payload(buffer, size, tag, compress, flags);
+    const auto priority = message_priority(flags);
+    if (!durable) {
+        Flatbuffers::MPIMessageBuilder builder;
+        const auto [mpi_buffer, mpi_size] = builder.build_mpi_message(
+            Messaging::MessageType_BROADCAST, PC_MODULE_ID, BROADCAST_DESTINATION,
+            next_lossy_sequence(BROADCAST_DESTINATION, tag), false, tag, payload, flags);
+        if (m_aggregator && priority != MessagePriority::Critical) {
+            return m_aggregator->enqueue(links.front().client, false, priority,
+                                         static_cast<uint8_t *>(mpi_buffer), mpi_size) < 0
+                       ? -1
+                       : 0;
+        }
+        return links.front().client->send_msg(mpi_buffer, mpi_size, priority) < 0 ? -1 : 0;
+    }
+
+    // Every connection gets its own copy, numbered in the stream to the module at the other end
+    // so it can be acknowledged and replayed. A slow connection should not hold up the rest,
+    // every link's sender writes its copy.
+    int result = 0;
+    std::vector<std::future<int>> sends;
+    sends.reserve(links.size());
+    for (auto &link : links) {
+        const auto sequence = next_sequence(link.hop);
+        Flatbuffers::MPIMessageBuilder builder;
+        const auto [mpi_buffer, mpi_size] = builder.build_mpi_message(
+            Messaging::MessageType_BROADCAST, PC_MODULE_ID, BROADCAST_DESTINATION, sequence, true,
+            tag, payload, flags, m_received_sequences[link.hop].cumulative());
+        const auto *data = static_cast<uint8_t *>(mpi_buffer);
+
+        std::optional<std::promise<int>> sent(std::in_place);
+        auto done = sent->get_future();
+        const auto credit = acquire_durable(link.hop, link.client, link.hop, sequence, priority,
+                                            data, mpi_size, sent);
+        if (credit == CreditResult::Exhausted) {
+            result = -1;
+            continue;
+        }
+        if (credit == CreditResult::Held) {
+            continue;
+        }
+
+        if (m_aggregator && priority != MessagePriority::Critical) {
+            if (m_aggregator->enqueue(link.client, true, priority,
+                                      static_cast<uint8_t *>(mpi_buffer), mpi_size) < 0) {
+                result = -1;
+            }
+            continue;
+        }
+        sends.push_back(std::move(done));
+        m_pacer->submit(link.hop, link.limits, std::move(link.client), {data, data + mpi_size},
+                        priority, std::move(sent));
+    }
+
+    for (auto &sent : sends) {
+        if (sent.get() < 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+std::optional<SizeAndSource> MessagingInterface::recv(uint8_t *buffer, const size_t size,
+                                                      uint8_t tag) {
+    return recv_from(buffer, size, ANY_SOURCE, tag);
+}
+
+std::optional<SizeAndSource> MessagingInterface::recv_from(uint8_t *buffer, const size_t size,
+                                                           const int source, const uint8_t tag) {
+    if (source != ANY_SOURCE && (source < 0 || source > UINT8_MAX)) {
+        return std::nullopt;
+    }
+
+    const auto data = recv_queue(source, tag).dequeue(MAX_RECV_WAIT_TIME);
     if (!data.has_value()) {
         return std::nullopt;
     }
 
-    // Anything in the queue should already be validated
-    const auto mpi_message =
-        Flatbuffers::MPIMessageBuilder::parse_mpi_message(data.value()->data());
-    const auto data_size = std::min(size, static_cast<size_t>(mpi_message->length()));
+    return read_message(*data.value(), buffer, size);
+}
+
+std::optional<RecvAnyResult> MessagingInterface::recv_any(uint8_t *buffer, const size_t size,
+                                                          const std::vector<RecvKey> &keys,
+                                                          const std::chrono::milliseconds timeout) {
+    std::vector<MessageQueue *> queues;
+    queues.reserve(keys.size());
+    for (const auto &[tag, source] : keys) {
+        if (source != ANY_SOURCE && (source < 0 || source > UINT8_MAX)) {
+            return std::nullopt;
+        }
+        queues.push_back(&recv_queue(source, tag));
+    }
+
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    m_recv_any_waiters++;
+    std::unique_lock lock(m_recv_any_mutex);
+
+    // Take the generation before scanning, anything enqueued after the scan bumps it.
+    while (true) {
+        const auto generation = m_recv_any_generation;
+        lock.unlock();
+
+        for (size_t i = 0; i < queues.size(); i++) {
+            if (auto data = queues[i]->try_dequeue()) {
+                m_recv_any_waiters--;
+                const auto received = read_message(*data.value(), buffer, size);
+                if (!received) {
+                    return std::nullopt;
+                }
+                return RecvAnyResult{i, *received};
+            }
+        }
+
+        lock.lock();
+        if (!m_recv_any_cond.wait_until(lock, deadline, [&] {
+                return m_recv_any_generation != generation;
+            })) {
+            m_recv_any_waiters--;
+            return std::nullopt;
+        }
+    }
+}
+
+// Anything in the queues should already be validated
+std::optional<SizeAndSource> MessagingInterface::read_message(const std::vector<uint8_t> &data,
+                                                              uint8_t *buffer, const size_t size) {
+    const auto mpi_message = Flatbuffers::MPIMessageBuilder::parse_mpi_message(data.data());
+    const auto data_size = Flatbuffers::MPIMessageBuilder::read_payload(mpi_message, buffer, size);
+    if (!data_size) {
+        spdlog::error("[LibRPC] Failed to decompress message on tag {}", mpi_message->tag());
+        return std::nullopt;
+    }
+
+    return std::make_optional<SizeAndSource>({*data_size, mpi_message->sender()});
+}
+
+static uint16_t reply_key(const uint8_t source, const uint8_t tag) {
+    return static_cast<uint16_t>(source << 8 | tag);
+}
+
+int MessagingInterface::sendrecv(uint8_t *send_buffer, const size_t send_size, const uint8_t dest,
+                                 const uint8_t send_tag, uint8_t *recv_buffer,
+                                 const size_t recv_size, const uint8_t recv_tag) {
+    if (on_dispatcher("sendrecv")) {
+        return -1;
+    }
+
+    // Register for the reply before sending, it can arrive before we start waiting.
+    const auto tracker = std::make_shared<CompletionTracker>(std::vector{dest}, recv_tag);
+    register_tracker(tracker);
+    if (send(send_buffer, send_size, dest, send_tag, true) == 0) {
+        tracker->wait_for(rpc_timeout(dest, MAX_RECV_WAIT_TIME));
+    }
+    unregister_tracker(tracker);
+
+    const auto results = tracker->take_results();
+    if (results.empty()) {
+        return -1;
+    }
+
+    const auto &reply = results.begin()->second;
+    const auto mpi_message = Flatbuffers::MPIMessageBuilder::parse_mpi_message(reply->data());
+    const auto data_size =
+        Flatbuffers::MPIMessageBuilder::read_payload(mpi_message, recv_buffer, recv_size);
+    if (!data_size) {
+        spdlog::error("[LibRPC] Failed to decompress reply on tag {}", recv_tag);
+        return -1;
+    }
+
+    return static_cast<int>(*data_size);
+}
+
+std::unordered_map<uint8_t, std::vector<uint8_t>>
+MessagingInterface::gather(const std::vector<uint8_t> &modules, const uint8_t tag,
+                           const std::chrono::milliseconds timeout) {
+    if (on_dispatcher("gather")) {
+        return {};
+    }
+    if (!distinct(modules)) {
+        spdlog::error("[LibRPC] gather on tag {} lists a module more than once", tag);
+        return {};
+    }
+
+    const auto tracker = std::make_shared<CompletionTracker>(modules, tag);
+    register_tracker(tracker);
+    tracker->wait_for(timeout);
+    unregister_tracker(tracker);
+
+    std::unordered_map<uint8_t, std::vector<uint8_t>> payloads;
+    for (const auto &[source, message] : tracker->take_results()) {
+        const auto mpi_message = Flatbuffers::MPIMessageBuilder::parse_mpi_message(message->data());
+        if (auto payload = Flatbuffers::MPIMessageBuilder::read_payload(mpi_message)) {
+            payloads.insert({source, std::move(*payload)});
+        } else {
+            spdlog::error("[LibRPC] Failed to decompress message from {} on tag {}", source, tag);
+        }
+    }
+    return payloads;
+}
+
+int MessagingInterface::scatter(const std::unordered_map<uint8_t, std::vector<uint8_t>> &payloads,
+                                const uint8_t tag, const bool durable) {
+    std::vector<std::future<int>> sends;
+    sends.reserve(payloads.size());
+    for (const auto &[module, payload] : payloads) {
+        auto *data = const_cast<uint8_t *>(payload.data());
+        sends.push_back(send_async(data, payload.size(), module, tag, durable));
+    }
+    return wait_all(sends);
+}
+
+int MessagingInterface::barrier(const std::vector<uint8_t> &modules, const uint8_t tag,
+                                const std::chrono::milliseconds timeout) {
+    if (on_dispatcher("barrier")) {
+        return -1;
+    }
+    if (!distinct(modules)) {
+        spdlog::error("[LibRPC] barrier on tag {} lists a module more than once", tag);
+        return -1;
+    }
+
+    const auto tracker = std::make_shared<CompletionTracker>(modules, tag);
+    register_tracker(tracker);
+
+    std::vector<std::future<int>> sends;
+    sends.reserve(modules.size());
+    for (const auto module : modules) {
+        sends.push_back(send_async(nullptr, 0, module, tag, true));
+    }
+    const bool done = wait_all(sends) == 0 && tracker->wait_for(timeout);
+    unregister_tracker(tracker);
+
+    return done ? 0 : -1;
+}
+
+// The dispatcher delivers the replies these calls wait for, so one made from an inline
+// subscription callback could only time out. Fails it straight away instead.
+bool MessagingInterface::on_dispatcher(const char *call) const {
+    if (std::this_thread::get_id() != m_rx_thread.get_id()) {
+        return false;
+    }
+    spdlog::error("[LibRPC] {} called from the dispatcher thread, use a subscription executor",
+                  call);
+    return true;
+}
+
+// A tracker waits for one message per entry, so a module listed twice could never complete it.
+bool MessagingInterface::distinct(const std::vector<uint8_t> &modules) {
+    const std::unordered_set<uint8_t> unique(modules.begin(), modules.end());
+    return unique.size() == modules.size();
+}
 
-    std::memcpy(buffer, mpi_message->payload()->data(), data_size);
+// 0 if every send succeeded, -1 otherwise.
+int MessagingInterface::wait_all(std::vector<std::future<int>> &sends) {
+    int result = 0;
+    for (auto &sent : sends) {
+        if (sent.get() < 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
 
-    return std::make_optional<SizeAndSource>({data_size, mpi_message->sender()});
+void MessagingInterface::register_tracker(const std::shared_ptr<CompletionTracker> &tracker) {
+    std::scoped_lock lock(m_reply_mutex);
+    for (const auto source : tracker->sources()) {
+        m_reply_trackers[reply_key(source, tracker->tag())].push_back(tracker);
+        m_pending_replies++;
+    }
 }
 
-int MessagingInterface::sendrecv(uint8_t *send_buffer, size_t send_size, uint8_t dest,
-                                 uint8_t send_tag, uint8_t *recv_buffer, size_t recv_size,
-                                 uint8_t recv_tag) {
-    // no-op
-    return -1;
+// Once this returns the dispatcher no longer completes the tracker, its results are final.
+void MessagingInterface::unregister_tracker(const std::shared_ptr<CompletionTracker> &tracker) {
+    std::scoped_lock lock(m_reply_mutex);
+    for (const auto source : tracker->sources()) {
+        const auto it = m_reply_trackers.find(reply_key(source, tracker->tag()));
+        if (it == m_reply_trackers.end()) {
+            continue;
+        }
+        m_pending_replies -= std::erase(it->second, tracker);
+        if (it->second.empty()) {
+            m_reply_trackers.erase(it);
+        }
+    }
+}
+
+// Hands data to the oldest tracker waiting on (source, tag). Returns false if there is none.
+bool MessagingInterface::take_reply(const uint8_t source, const uint8_t tag,
+                                    std::unique_ptr<std::vector<uint8_t>> &data) {
+    std::scoped_lock lock(m_reply_mutex);
+    const auto it = m_reply_trackers.find(reply_key(source, tag));
+    if (it == m_reply_trackers.end()) {
+        return false;
+    }
+
+    const auto tracker = std::move(it->second.front());
+    it->second.pop_front();
+    if (it->second.empty()) {
+        m_reply_trackers.erase(it);
+    }
+    m_pending_replies--;
+
+    tracker->complete(source, std::move(data));
+    return true;
 }
 
 std::unordered_set<uint8_t>
@@ -98,59 +801,559 @@ MessagingInterface::find_connected_modules(const std::chrono::duration<double> s
     // list of modules.
     std::unique_lock scan_lock(m_scan_mutex);
     const auto foundModules = this->m_discovery_service->find_modules(scan_duration);
-    scan_lock.unlock();
+    connect_new_modules();
 
-    std::unique_lock lock(m_client_mutex);
+    return foundModules;
+}
+
+void MessagingInterface::handle_module_events() {
+    while (!m_stop_flag) {
+        const auto change = m_module_event_queue->dequeue(MAX_WAIT_TIME_RX_THREAD_DEQUEUE);
+        if (!change.has_value()) {
+            continue;
+        }
+
+        const auto &[event, module] = change.value();
+        std::unique_lock scan_lock(m_scan_mutex);
+        switch (event) {
+        case ModuleEvent::Added:
+            spdlog::info("[LibRPC] Module {} appeared at {}", module.id, module.ip);
+            connect_new_modules();
+            break;
+        case ModuleEvent::Removed:
+            spdlog::info("[LibRPC] Module {} went away", module.id);
+            m_routing_table.remove_module(module.id);
+            disconnect_module(module.id);
+            m_replay_buffer.remove(module.id);
+            // When it comes back it may have restarted without a session id to tell us so.
+            m_received_sequences[module.id].reset();
+            m_loss_tracker.reset(module.id);
+            m_nack_channel->reset(module.id);
+            break;
+        case ModuleEvent::Updated: {
+            std::shared_lock lock(m_client_mutex);
+            const auto ip = m_id_to_ip.find(module.id);
+            const bool moved = ip == m_id_to_ip.end() || ip->second != module.ip;
+            lock.unlock();
 
+            if (moved) {
+                spdlog::info("[LibRPC] Module {} moved to {}, reconnecting", module.id, module.ip);
+                disconnect_module(module.id);
+                connect_new_modules();
+            } else {
+                m_routing_table.update_module(module);
+                std::unique_lock write_lock(m_client_mutex);
+                set_accepts_compression(module);
+            }
+            break;
+        }
+        }
+    }
+}
+
+// Must be called with m_scan_mutex held.
+void MessagingInterface::connect_new_modules() {
+    std::shared_lock lock(m_client_mutex);
     std::vector<uint8_t> existing_clients;
     existing_clients.reserve(m_id_to_lossless_client.size());
     for (auto &kv : m_id_to_lossless_client) {
         existing_clients.push_back(kv.first);
     }
+    lock.unlock();
 
+    // Connecting can take a while, do not hold up senders in the meantime.
     const auto new_lossless =
         this->m_discovery_service->get_lossless_clients(m_rx_queue, existing_clients);
     const auto new_lossy =
         this->m_discovery_service->get_lossy_clients(m_rx_queue, existing_clients);
 
+    const auto modules = this->m_discovery_service->get_modules();
+
+    std::unique_lock write_lock(m_client_mutex);
     m_id_to_lossless_client.insert(new_lossless.begin(), new_lossless.end());
     m_id_to_lossy_client.insert(new_lossy.begin(), new_lossy.end());
+    for (const auto &[id, module] : modules) {
+        m_id_to_ip.insert_or_assign(id, module.ip);
+        m_id_to_type.insert_or_assign(id, module.module_type);
+        set_accepts_compression(module);
+        m_routing_table.update_module(module);
+    }
+    write_lock.unlock();
 
-    return foundModules;
+    // A module we were connected to before gets what it missed in between, here and on every
+    // reconnect of the client. Here the link's sender writes it, paced like any other send.
+    for (const auto &[id, client] : new_lossless) {
+        const std::weak_ptr<ICommunicationClient> link = client;
+        for (auto &frame : reconnected(id, link)) {
+            send_released(id, client, std::move(frame), MessagePriority::Normal, std::nullopt);
+        }
+        client->set_replay_source([this, id, link] { return reconnected(id, link); });
+    }
+}
+
+void MessagingInterface::disconnect_module(const uint8_t module_id) {
+    std::vector<std::shared_ptr<ICommunicationClient>> removed;
+
+    std::unique_lock lock(m_client_mutex);
+    for (auto *clients : {&m_id_to_lossless_client, &m_id_to_lossy_client}) {
+        if (const auto it = clients->find(module_id); it != clients->end()) {
+            removed.push_back(std::move(it->second));
+            clients->erase(it);
+        }
+    }
+    m_id_to_ip.erase(module_id);
+    m_id_to_type.erase(module_id);
+    m_accepts_compression.erase(module_id);
+    lock.unlock();
+
+    m_pacer->remove(module_id);
+    m_credit_gate.remove(module_id);
+    m_link_monitor.remove(module_id);
+
+    // Clients join their threads when destroyed, which must not happen under the lock.
+    for (const auto &client : removed) {
+        client->set_replay_source(nullptr);
+    }
+    removed.clear();
+}
+
+void MessagingInterface::enable_aggregation(const std::chrono::microseconds max_delay,
+                                            const size_t max_frame_size) {
+    std::unique_lock lock(m_client_mutex);
+    m_aggregator = std::make_unique<MessageAggregator>(max_delay, max_frame_size);
+}
+
+void MessagingInterface::disable_aggregation() {
+    std::unique_lock lock(m_client_mutex);
+    m_aggregator.reset(); // flushes anything still pending
+}
+
+void MessagingInterface::flush() {
+    std::shared_lock lock(m_client_mutex);
+    if (m_aggregator) {
+        m_aggregator->flush();
+    }
+}
+
+void MessagingInterface::set_compression(const uint8_t tag, const bool enabled) {
+    m_compressed_tags[tag] = enabled;
+}
+
+void MessagingInterface::set_priority(const uint8_t tag, const MessagePriority priority) {
+    m_tag_priorities[tag] = priority;
+}
+
+void MessagingInterface::set_pacing(const ModuleType type,
+                                    const std::optional<PacingLimits> limits) {
+    std::unique_lock lock(m_client_mutex);
+    if (limits) {
+        m_pacing_limits.insert_or_assign(type, *limits);
+    } else {
+        m_pacing_limits.erase(type);
+    }
+}
+
+PacingStats MessagingInterface::pacing_stats(const uint8_t module) {
+    return m_pacer->stats(module);
+}
+
+void MessagingInterface::set_credit_policy(const CreditPolicy policy) {
+    m_credit_policy = policy;
+}
+
+std::optional<CreditStats> MessagingInterface::credit_stats(const uint8_t module) {
+    return m_credit_gate.stats(module);
+}
+
+std::optional<RttEstimate> MessagingInterface::rtt_estimate(const uint8_t module) const {
+    return m_link_monitor.estimate(module);
+}
+
+std::chrono::milliseconds
+MessagingInterface::rpc_timeout(const uint8_t module,
+                                const std::chrono::milliseconds processing_budget) const {
+    const auto estimate = m_link_monitor.estimate(module);
+    if (!estimate) {
+        return processing_budget;
+    }
+    return processing_budget +
+           std::chrono::ceil<std::chrono::milliseconds>(estimate->rto * RPC_TIMEOUT_RTO_MULTIPLE);
+}
+
+static int64_t heartbeat_clock() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Heartbeats measure the link, so they are Critical and never wait behind credits or
+// aggregation. They also carry our ack when there is nothing else to carry it.
+static std::vector<uint8_t> heartbeat_frame(const uint8_t destination, const uint8_t kind,
+                                            const int64_t timestamp, const uint16_t ack) {
+    std::vector<uint8_t> payload(HEARTBEAT_SIZE);
+    payload[0] = kind;
+    std::memcpy(payload.data() + 1, &timestamp, sizeof(timestamp));
+
+    const auto flags = priority_flags(MessagePriority::Critical);
+    Flatbuffers::MPIMessageBuilder builder;
+    const auto [mpi_buffer, mpi_size] =
+        builder.build_mpi_message(Messaging::MessageType_PTP, PC_MODULE_ID, destination, 0, true,
+                                  HEARTBEAT_TAG, payload, flags, ack);
+    const auto *data = static_cast<uint8_t *>(mpi_buffer);
+    return {data, data + mpi_size};
+}
+
+// Pings every connected module. A module that went silent has its connection dropped, the
+// client reconnects on its own thread and everything kept per link carries on.
+void MessagingInterface::handle_heartbeats() {
+    auto next_beat = std::chrono::steady_clock::now();
+    while (!m_stop_flag) {
+        if (std::chrono::steady_clock::now() < next_beat) {
+            std::this_thread::sleep_for(HEARTBEAT_POLL_INTERVAL);
+            continue;
+        }
+        next_beat = std::chrono::steady_clock::now() + HEARTBEAT_INTERVAL;
+
+        std::shared_lock lock(m_client_mutex);
+        const auto clients = m_id_to_lossless_client;
+        lock.unlock();
+
+        // Straight to the client, this thread does nothing else in the meantime.
+        for (const auto &[id, client] : clients) {
+            auto frame = heartbeat_frame(id, HEARTBEAT_PING, heartbeat_clock(),
+                                         m_received_sequences[id].cumulative());
+            client->send_msg(frame.data(), frame.size(), MessagePriority::Critical);
+        }
+
+        for (const auto module :
+             m_link_monitor.silent_modules(HEARTBEAT_INTERVAL * HEARTBEAT_MISSED_LIMIT)) {
+            spdlog::warn("[LibRPC] Module {} stopped answering heartbeats, reconnecting", module);
+            if (const auto it = clients.find(module); it != clients.end()) {
+                it->second->drop_connection();
+            }
+        }
+    }
+}
+
+// Answers pings from modules, and feeds the RTT of answers to ours into the estimators.
+void MessagingInterface::handle_heartbeat(const Messaging::MPIMessage *mpi_message) {
+    const auto payload = mpi_message->payload();
+    if (!payload || payload->size() != HEARTBEAT_SIZE) {
+        spdlog::warn("[LibRPC] Got a malformed heartbeat from {}", mpi_message->sender());
+        return;
+    }
+
+    const auto sender = mpi_message->sender();
+    int64_t timestamp = 0;
+    std::memcpy(&timestamp, payload->data() + 1, sizeof(timestamp));
+
+    // The link's sender writes the answer, a write blocked on a full socket must not hold up
+    // the dispatcher. As Critical it still goes ahead of anything queued on the link.
+    if (payload->Get(0) == HEARTBEAT_PING) {
+        std::shared_lock lock(m_client_mutex);
+        const auto hop = m_routing_table.next_hop(sender);
+        auto client = client_for(sender, true);
+        if (!hop || !client) {
+            return;
+        }
+        const auto *limits = pacing_limits(*hop);
+        m_pacer->submit(*hop, limits ? *limits : PacingLimits{}, std::move(client),
+                        heartbeat_frame(sender, HEARTBEAT_PONG, timestamp,
+                                        m_received_sequences[sender].cumulative()),
+                        MessagePriority::Critical, std::nullopt);
+        return;
+    }
+
+    const auto rtt = std::chrono::microseconds(heartbeat_clock() - timestamp);
+    if (rtt.count() < 0) {
+        return;
+    }
+    m_link_monitor.record_rtt(sender, rtt);
+    if (const auto estimate = m_link_monitor.estimate(sender)) {
+        m_routing_table.set_link_rtt(sender, estimate->srtt);
+    }
 }
 
 void MessagingInterface::handle_recv() {
     while (!m_stop_flag) {
         if (auto data = this->m_rx_queue->dequeue(MAX_WAIT_TIME_RX_THREAD_DEQUEUE);
             data.has_value()) {
-            flatbuffers::Verifier verifier(data.value()->data(), data.value()->size());
-            bool ok = Messaging::VerifyMPIMessageBuffer(verifier);
-            if (!ok) {
-                spdlog::error("[LibRPC] Got invalid flatbuffer data");
-                continue;
-            }
+            dispatch(std::move(data.value()), true);
+        }
+    }
+}
+
+// data has been verified, by the rx queue or when it was unpacked from an aggregate frame.
+void MessagingInterface::dispatch(std::unique_ptr<std::vector<uint8_t>> data,
+                                  const bool unpack_aggregate) {
+    const auto &mpi_message = Flatbuffers::MPIMessageBuilder::parse_mpi_message(data->data());
+    const auto sender = mpi_message->sender();
+    m_link_monitor.heard_from(sender);
+    // Credits are spent per link, so a grant counts for the link the sender is reached through.
+    m_credit_gate.grant(m_routing_table.next_hop(sender).value_or(sender),
+                        mpi_message->credits());
 
-            const auto &mpi_message =
-                Flatbuffers::MPIMessageBuilder::parse_mpi_message(data.value()->data());
+    if (mpi_message->type() == Messaging::MessageType_AGGREGATE) {
+        if (!unpack_aggregate) {
+            spdlog::warn("[LibRPC] Discarding nested aggregate frame");
+            return;
+        }
 
-            std::unique_lock lock(m_tag_queue_mutex);
-            if (!m_tag_to_queue_map.contains(mpi_message->tag())) {
-                m_tag_to_queue_map.insert(
-                    {mpi_message->tag(),
-                     std::make_unique<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>>(
-                         PER_TAG_MAX_QUEUE_SIZE)});
+        MessageAggregator::unpack(mpi_message, [this](const uint8_t *inner, const size_t size) {
+            flatbuffers::Verifier verifier(inner, size);
+            if (!Messaging::VerifyMPIMessageBuffer(verifier)) {
+                spdlog::error("[LibRPC] Got invalid flatbuffer data in aggregate frame");
+                return;
             }
-            const auto &queue = m_tag_to_queue_map[mpi_message->tag()];
-            lock.unlock();
+            dispatch(std::make_unique<std::vector<uint8_t>>(inner, inner + size), false);
+        });
+        return;
+    }
 
-            queue->enqueue(std::move(data.value()), MAX_WAIT_TIME_TAG_ENQUEUE);
+    if (mpi_message->type() == Messaging::MessageType_NACK) {
+        handle_nack(mpi_message);
+        return;
+    }
+
+    m_replay_buffer.acknowledge(mpi_message->sender(), mpi_message->ack());
+    if (mpi_message->is_durable() &&
+        !m_received_sequences[sender].accept(mpi_message->sequence_number(),
+                                             mpi_message->session())) {
+        return; // replayed after a reconnect, but we already had it
+    }
+    const bool reliable = mpi_message->flags() & Flatbuffers::MPI_FLAG_RELIABLE;
+    if (reliable &&
+        !m_nack_channel->received(sender, mpi_message->sequence_number(),
+                                  mpi_message->session())) {
+        return; // retransmitted, but we already had it
+    }
+    if (!mpi_message->is_durable() && !reliable && mpi_message->sequence_number() != 0) {
+        const auto tag = mpi_message->tag();
+        const auto arrival = m_loss_tracker.track(sender, tag, mpi_message->sequence_number(),
+                                                  mpi_message->session());
+        if (arrival == Arrival::Duplicate) {
+            return;
         }
+        if (arrival == Arrival::Late && m_drop_stale_tags[tag]) {
+            m_loss_tracker.count_stale_drop(sender);
+            return;
+        }
+    }
+
+    if (mpi_message->tag() == HEARTBEAT_TAG) {
+        handle_heartbeat(mpi_message);
+        return;
+    }
+
+    // Most of the time nobody is waiting on a reply, skip the lock then.
+    if (m_pending_replies > 0 && take_reply(mpi_message->sender(), mpi_message->tag(), data)) {
+        return;
+    }
+
+    if (mpi_message->tag() == m_state_tag) {
+        update_module_state(mpi_message);
+        deliver_to_subscribers(mpi_message);
+        return;
+    }
+
+    if (deliver_to_subscribers(mpi_message)) {
+        return;
+    }
+
+    const auto tag = mpi_message->tag();
+    if (!dispatch_queue(sender, tag).enqueue(std::move(data), MAX_WAIT_TIME_TAG_ENQUEUE)) {
+        spdlog::warn("[LibRPC] Receive queue for tag {} full, dropped a message from {}", tag,
+                     sender);
+        return;
+    }
+
+    if (m_recv_any_waiters > 0) {
+        {
+            std::scoped_lock lock(m_recv_any_mutex);
+            m_recv_any_generation++;
+        }
+        m_recv_any_cond.notify_all();
     }
 }
 
+void MessagingInterface::set_state_tag(const uint8_t tag) {
+    m_state_tag = tag;
+}
+
+std::optional<ModuleStateSnapshot> MessagingInterface::module_state(const uint8_t module) const {
+    return m_module_states.get(module);
+}
+
+void MessagingInterface::update_module_state(const Messaging::MPIMessage *mpi_message) {
+    const auto received = std::chrono::steady_clock::now();
+
+    // Read uncompressed payloads in place, only decompression needs a copy.
+    std::optional<std::vector<uint8_t>> decompressed;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    if (mpi_message->flags() & Flatbuffers::MPI_FLAG_COMPRESSED) {
+        decompressed = Flatbuffers::MPIMessageBuilder::read_payload(mpi_message);
+        if (!decompressed) {
+            spdlog::error("[LibRPC] Failed to decompress state from {}", mpi_message->sender());
+            return;
+        }
+        data = decompressed->data();
+        size = decompressed->size();
+    } else if (const auto payload = mpi_message->payload()) {
+        data = payload->data();
+        size = std::min(static_cast<size_t>(mpi_message->length()),
+                        static_cast<size_t>(payload->size()));
+    }
+
+    if (!data) {
+        return;
+    }
+    flatbuffers::Verifier verifier(data, size);
+    if (!VerifyRobotModuleBuffer(verifier)) {
+        spdlog::warn("[LibRPC] Got invalid state from {}", mpi_message->sender());
+        return;
+    }
+
+    m_module_states.update(*GetRobotModule(data), received);
+}
+
+SubscriptionId MessagingInterface::subscribe(const uint8_t tag, Subscription::Callback callback,
+                                             Subscription::Executor executor) {
+    std::unique_lock lock(m_subscription_mutex);
+    const auto id = m_next_subscription_id++;
+    m_subscriptions[tag].emplace_back(
+        id, std::make_shared<Subscription>(std::move(callback), std::move(executor)));
+    return id;
+}
+
+void MessagingInterface::unsubscribe(const SubscriptionId id) {
+    std::shared_ptr<Subscription> removed;
+
+    std::unique_lock lock(m_subscription_mutex);
+    for (auto &subscriptions : m_subscriptions) {
+        const auto it = std::ranges::find_if(
+            subscriptions, [id](const auto &subscription) { return subscription.first == id; });
+        if (it != subscriptions.end()) {
+            removed = std::move(it->second);
+            subscriptions.erase(it);
+            break;
+        }
+    }
+    lock.unlock();
+
+    // The subscription may hold state the caller owns, let it go outside the lock.
+    removed.reset();
+}
+
+// Returns false if nothing is subscribed to the message's tag.
+bool MessagingInterface::deliver_to_subscribers(const Messaging::MPIMessage *mpi_message) {
+    std::shared_lock lock(m_subscription_mutex);
+    const auto &subscribed = m_subscriptions[mpi_message->tag()];
+    if (subscribed.empty()) {
+        return false;
+    }
+    std::vector<std::shared_ptr<Subscription>> subscriptions;
+    subscriptions.reserve(subscribed.size());
+    for (const auto &[_, subscription] : subscribed) {
+        subscriptions.push_back(subscription);
+    }
+    lock.unlock();
+
+    // Callbacks run without the lock, so they can subscribe and unsubscribe themselves.
+    auto payload = Flatbuffers::MPIMessageBuilder::read_payload(mpi_message);
+    if (!payload) {
+        spdlog::error("[LibRPC] Failed to decompress message on tag {}", mpi_message->tag());
+        return true;
+    }
+    for (size_t i = 0; i < subscriptions.size(); i++) {
+        subscriptions[i]->deliver(i + 1 == subscriptions.size() ? std::move(*payload) : *payload,
+                                  mpi_message->sender());
+    }
+    return true;
+}
+
+// Conflating receive queues keep the latest message per sender.
+static uint64_t message_sender(const std::unique_ptr<std::vector<uint8_t>> &data) {
+    return Flatbuffers::MPIMessageBuilder::parse_mpi_message(data->data())->sender();
+}
+
+template <typename F>
+void MessagingInterface::for_each_queue(const TagQueues &queues, F &&f) {
+    if (queues.any) {
+        f(*queues.any);
+    }
+    for (const auto &queue : queues.from_source) {
+        if (queue) {
+            f(*queue);
+        }
+    }
+}
+
+void MessagingInterface::set_overflow_policy(const uint8_t tag, const OverflowPolicy policy) {
+    std::scoped_lock lock(m_tag_queue_mutex);
+    m_tag_policies[tag] = policy;
+    if (const auto &queues = m_tag_queues[tag]) {
+        for_each_queue(*queues,
+                       [&](MessageQueue &queue) { queue.set_policy(policy, message_sender); });
+    }
+}
+
+QueueStats MessagingInterface::queue_stats(const uint8_t tag) {
+    QueueStats total;
+    std::scoped_lock lock(m_tag_queue_mutex);
+    if (const auto &queues = m_tag_queues[tag]) {
+        for_each_queue(*queues, [&](MessageQueue &queue) {
+            const auto stats = queue.stats();
+            total.enqueued += stats.enqueued;
+            total.dropped += stats.dropped;
+            total.evicted += stats.evicted;
+            total.conflated += stats.conflated;
+        });
+    }
+    return total;
+}
+
+QueueStats MessagingInterface::rx_queue_stats(const MessagePriority priority) const {
+    return m_rx_queue->stats(priority);
+}
+
+// Queues are created on first use and live as long as the interface, so references stay valid
+// once the lock is released.
+MessagingInterface::MessageQueue &MessagingInterface::recv_queue(const int source,
+                                                                 const uint8_t tag) {
+    std::scoped_lock lock(m_tag_queue_mutex);
+    auto &queues = m_tag_queues[tag];
+    if (!queues) {
+        queues = std::make_unique<TagQueues>();
+    }
+
+    auto &queue = source == ANY_SOURCE ? queues->any : queues->from_source[source];
+    if (!queue) {
+        queue = std::make_unique<MessageQueue>(PER_TAG_MAX_QUEUE_SIZE, m_tag_policies[tag],
+                                               message_sender);
+    }
+    return *queue;
+}
+
+MessagingInterface::MessageQueue &MessagingInterface::dispatch_queue(const uint8_t source,
+                                                                     const uint8_t tag) {
+    {
+        std::scoped_lock lock(m_tag_queue_mutex);
+        if (const auto &queues = m_tag_queues[tag]; queues && queues->from_source[source]) {
+            return *queues->from_source[source];
+        }
+    }
+    return recv_queue(ANY_SOURCE, tag);
+}
+
 std::optional<std::unique_ptr<std::vector<uint8_t>>>
 MessagingInterface::remote_call(uint8_t function_tag, uint8_t module_id,
-                                const std::vector<uint8_t> &parameters) {
+                                const std::vector<uint8_t> &parameters,
+                                const std::chrono::milliseconds processing_budget) {
+    if (on_dispatcher("remote_call")) {
+        return std::nullopt;
+    }
+
     std::unique_lock lock(m_fn_call_mutex);
     const auto unique_id = unique_fn_call_id++;
     auto sem = std::make_unique<std::counting_semaphore<1>>(0);
@@ -166,7 +1369,8 @@ MessagingInterface::remote_call(uint8_t function_tag, uint8_t module_id,
     // themselves.
     send((uint8_t *)data, size, module_id, FN_CALL_TAG, true);
 
-    if (m_fn_call_to_semaphore[unique_id]->try_acquire_for(FN_CALL_TIMEOUT)) {
+    const auto timeout = rpc_timeout(module_id, processing_budget);
+    if (m_fn_call_to_semaphore[unique_id]->try_acquire_for(timeout)) {
         lock.lock();
 
         if (!m_fn_call_to_result[unique_id]) {
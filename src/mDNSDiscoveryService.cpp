@@ -6,22 +6,42 @@
 #include <cstring>
 #include <iostream>
 #include <optional>
+#include <span>
+#include <string_view>
 #include <thread>
 
+#include "ClientFactory.h"
+#include "DiscoveryCache.h"
 #include "TCPClient.h"
 #include "mDNSDiscoveryService.h"
+#include "mDNSParser.h"
 
 #include "UDPClient.h"
 #include "spdlog/spdlog.h"
-#include "util/ip.h"
-#include "util/string.h"
+#include "util/log.h"
+
+#undef min
+#undef max
 
 #define MDNS_PORT 5353
 #define MDNS_GROUP "224.0.0.251"
 #define RECV_BLOCK_SIZE 1024
-#define MODULE_TYPE_STR "module_type"
-#define MODULE_ID_STR "module_id"
-#define CONNECTED_MODULES_STR "connected_modules"
+
+constexpr auto INITIAL_QUERY_COUNT = 4;
+constexpr auto INITIAL_QUERY_INTERVAL = std::chrono::milliseconds(250);
+constexpr auto QUERY_INTERVAL = std::chrono::seconds(2);
+constexpr auto MAX_QUERY_INTERVAL = std::chrono::seconds(60);
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(100);
+constexpr auto SOCKET_RETRY_DELAY = std::chrono::seconds(1);
+constexpr auto CACHED_MODULE_TTL = std::chrono::seconds(10);
+
+constexpr std::string_view SERVICE_NAME = "_robotcontrol._tcp.local";
+constexpr size_t QUERY_BUFFER_SIZE = 1024;
+constexpr uint16_t RECORD_TYPE_PTR = 12;
+constexpr uint16_t CLASS_IN = 0x0001;
+constexpr uint16_t CLASS_UNICAST_RESPONSE = 0x8000; // QU bit on a question
+constexpr uint16_t FLAG_TRUNCATED = 0x0200;         // more known answers follow
+constexpr uint16_t FIRST_NAME_POINTER = 0xC000 | 12; // name right after the header
 
 #pragma pack(push, 1) // prevent padding between struct members
 struct query_header {
@@ -33,46 +53,184 @@ struct query_header {
     uint16_t num_additional;
 };
 
-struct query_footer { // footer for the question not for the packet
-    uint16_t type = htons(0x00FF);
-    uint16_t class_id = htons(0x8001);
-};
+#pragma pack(pop)
+
+// Bounds checked big endian writes into a query packet.
+struct query_writer {
+    std::span<uint8_t> buffer;
+    size_t offset;
+
+    bool u16(const uint16_t value) {
+        if (buffer.size() - offset < 2) {
+            return false;
+        }
+        buffer[offset++] = static_cast<uint8_t>(value >> 8);
+        buffer[offset++] = static_cast<uint8_t>(value);
+        return true;
+    }
+
+    bool u32(const uint32_t value) {
+        return u16(static_cast<uint16_t>(value >> 16)) && u16(static_cast<uint16_t>(value));
+    }
 
-struct answer {
-    uint16_t type;
-    uint16_t answer_class;
-    uint32_t ttl;
-    uint16_t data_length;
+    bool name(std::string_view name) {
+        while (!name.empty()) {
+            const auto dot = name.find('.');
+            const auto label = name.substr(0, dot);
+            if (label.empty() || label.size() > 63 || buffer.size() - offset < label.size() + 1) {
+                return false;
+            }
+            buffer[offset++] = static_cast<uint8_t>(label.size());
+            std::memcpy(buffer.data() + offset, label.data(), label.size());
+            offset += label.size();
+            name = dot == std::string_view::npos ? std::string_view{} : name.substr(dot + 1);
+        }
+        if (offset == buffer.size()) {
+            return false;
+        }
+        buffer[offset++] = 0;
+        return true;
+    }
 };
 
-#pragma pack(pop)
+mDNSDiscoveryService::mDNSDiscoveryService(std::optional<std::filesystem::path> cache_path)
+    : m_cache_path(std::move(cache_path)), m_started(std::chrono::steady_clock::now()),
+      m_stop_flag(false) {
+    if (m_cache_path) {
+        // Cached modules only live long enough for the browser to confirm them.
+        for (const auto &module : DiscoveryCache::load(*m_cache_path)) {
+            m_registry.update(module, CACHED_MODULE_TTL);
+            m_warm_started = true;
+        }
+        spdlog::info("[mDNS] Loaded {} cached modules", m_registry.ids().size());
+    }
 
-mDNSDiscoveryService::mDNSDiscoveryService() = default;
+    m_thread = std::thread(&mDNSDiscoveryService::browse_thread, this);
+}
 
-mDNSDiscoveryService::~mDNSDiscoveryService() = default;
+mDNSDiscoveryService::~mDNSDiscoveryService() {
+    {
+        std::scoped_lock lock(m_stop_mutex);
+        m_stop_flag = true;
+    }
+    m_stop_cond.notify_all();
+    m_thread.join();
+}
 
 std::unordered_set<uint8_t>
 mDNSDiscoveryService::find_modules(const std::chrono::duration<double> wait_time) {
-    std::unordered_set<uint8_t> modules{};
+    // Only block while the browser has not been running for wait_time yet, after that the
+    // registry is already as good as a fresh scan would be. A warm cache is good enough to
+    // start with, corrections are reported through the module callbacks.
+    if (m_warm_started) {
+        return m_registry.ids();
+    }
 
+    const auto ready_at =
+        m_started + std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait_time);
+    std::unique_lock stop_lock(m_stop_mutex);
+    m_stop_cond.wait_until(stop_lock, ready_at, [this] { return m_stop_flag.load(); });
+    stop_lock.unlock();
+
+    return m_registry.ids();
+}
+
+std::unordered_map<uint8_t, mDNSRobotModule> mDNSDiscoveryService::get_modules() {
+    return m_registry.modules();
+}
+
+void mDNSDiscoveryService::add_module_callback(ModuleEventCallback callback) {
+    std::scoped_lock lock(m_callback_mutex);
+
+    // Bring the new subscriber up to date, modules may already be known.
+    for (const auto &[_, module] : m_registry.modules()) {
+        callback(ModuleEvent::Added, module);
+    }
+    m_callbacks.emplace_back(std::move(callback));
+}
+
+void mDNSDiscoveryService::browse_thread() {
+    socket_t sock = -1;
+    while (!m_stop_flag && (sock = open_socket()) < 0) {
+        std::unique_lock lock(m_stop_mutex);
+        m_stop_cond.wait_for(lock, SOCKET_RETRY_DELAY, [this] { return m_stop_flag.load(); });
+    }
+    if (m_stop_flag) {
+        if (sock >= 0) {
+            CLOSE_SOCKET(sock);
+        }
+        return;
+    }
+
+    sockaddr_in mcast_addr{};
+    mcast_addr.sin_family = AF_INET;
+    mcast_addr.sin_port = htons(MDNS_PORT);
+    inet_pton(AF_INET, MDNS_GROUP, &mcast_addr.sin_addr);
+
+    int queries_sent = 0;
+    m_next_query = std::chrono::steady_clock::now();
+    m_query_interval = QUERY_INTERVAL;
+
+    while (!m_stop_flag) {
+        const auto now = std::chrono::steady_clock::now();
+        const auto refresh = m_registry.next_refresh();
+        if (now >= m_next_query) {
+            // The initial burst asks for unicast replies so other hosts do not all receive
+            // them, after that the interval doubles while nothing changes (RFC 6762 5.2).
+            const bool initial = queries_sent++ < INITIAL_QUERY_COUNT;
+            send_mdns_query(sock, mcast_addr, m_registry.record_query(now), initial);
+            if (initial) {
+                m_next_query = now + INITIAL_QUERY_INTERVAL;
+            } else {
+                m_next_query = now + m_query_interval;
+                m_query_interval = std::min(m_query_interval * 2, max_query_interval());
+            }
+        } else if (refresh && now >= *refresh) {
+            // Records getting close to their TTL are asked for on their own schedule, which
+            // leaves the backoff alone.
+            send_mdns_query(sock, mcast_addr, m_registry.record_query(now), false);
+        }
+
+        expire_modules();
+
+        // Wake for the next query or refresh, or periodically to notice the stop flag.
+        auto wake = m_next_query;
+        if (const auto next_refresh = m_registry.next_refresh()) {
+            wake = std::min(wake, *next_refresh);
+        }
+        const auto wait = std::min(std::chrono::duration_cast<std::chrono::microseconds>(
+                                       wake - std::chrono::steady_clock::now()),
+                                   std::chrono::microseconds(POLL_INTERVAL));
+        timeval tv{};
+        tv.tv_sec = static_cast<long>(std::max<int64_t>(wait.count(), 0) / 1000000);
+        tv.tv_usec = static_cast<long>(std::max<int64_t>(wait.count(), 0) % 1000000);
+
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(sock, &read_set);
+        if (select(static_cast<int>(sock) + 1, &read_set, nullptr, nullptr, &tv) > 0) {
+            drain_responses(sock);
+        }
+    }
+
+    CLOSE_SOCKET(sock);
+}
+
+socket_t mDNSDiscoveryService::open_socket() {
     const socket_t sock = socket(AF_INET, SOCK_DGRAM, 0);
     if (sock < 0) {
-        printf("socket() failed: %s\n", strerror(errno));
-        return modules;
+        spdlog::error("[mDNS] Failed to create socket");
+        print_errno();
+        return -1;
     }
 
     constexpr int reuse = 1;
-    timeval tv{};
-    tv.tv_sec = 1;
-    tv.tv_usec = 0;
 #ifdef _WIN32
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse));
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char *)&tv, sizeof tv);
     // Windows does not support SO_REUSEPORT
 #else
     setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
     setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
-    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
 #endif
 
     sockaddr_in localAddr{};
@@ -80,9 +238,10 @@ mDNSDiscoveryService::find_modules(const std::chrono::duration<double> wait_time
     localAddr.sin_port = htons(MDNS_PORT);
     localAddr.sin_addr.s_addr = INADDR_ANY;
     if (bind(sock, reinterpret_cast<sockaddr *>(&localAddr), sizeof(localAddr)) < 0) {
-        printf("bind() failed: %s\n", strerror(errno));
+        spdlog::error("[mDNS] Failed to bind to port {}", MDNS_PORT);
+        print_errno();
         CLOSE_SOCKET(sock);
-        return modules;
+        return -1;
     }
 
     // Join mDNS multicast group
@@ -95,279 +254,174 @@ mDNSDiscoveryService::find_modules(const std::chrono::duration<double> wait_time
 #else
     if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
 #endif
-        printf("setsockopt() failed: %s\n", strerror(errno));
+        spdlog::error("[mDNS] Failed to join multicast group");
+        print_errno();
         CLOSE_SOCKET(sock);
-        return modules;
+        return -1;
     }
 
-    // Send mDNS query and get responses
-    sockaddr_in mcastAddr{};
-    mcastAddr.sin_family = AF_INET;
-    mcastAddr.sin_port = htons(MDNS_PORT);
-    inet_pton(AF_INET, MDNS_GROUP, &mcastAddr.sin_addr);
-    const auto start = std::chrono::system_clock::now();
-    std::vector<std::unique_ptr<std::vector<uint8_t>>> responses;
-
-    while (std::chrono::system_clock::now() - start < wait_time) {
-        send_mdns_query(sock, mcastAddr);
+    return sock;
+}
 
-        std::this_thread::sleep_for(wait_time / 5);
+void mDNSDiscoveryService::drain_responses(const socket_t sock) {
+    uint8_t buffer[RECV_BLOCK_SIZE];
 
-        responses.emplace_back(std::make_unique<std::vector<uint8_t>>());
-        responses.back()->resize(RECV_BLOCK_SIZE);
+    // Keep reading until the socket has nothing left, replies from many modules arrive in
+    // the same burst.
+    while (true) {
 #ifdef _WIN32
-        const auto len = recv(sock, (char *)responses.back()->data(), RECV_BLOCK_SIZE, 0);
+        const auto len = recv(sock, (char *)buffer, RECV_BLOCK_SIZE, 0);
 #else
-        const auto len = recv(sock, responses.back()->data(), RECV_BLOCK_SIZE, 0);
+        const auto len = recv(sock, buffer, RECV_BLOCK_SIZE, 0);
 #endif
         if (len > 0) {
-            responses.back()->resize(len);
-        } else {
-            responses.pop_back();
+            if (const auto response =
+                    mDNSParser::parse_response({buffer, static_cast<size_t>(len)});
+                response.has_value()) {
+                handle_response(response.value());
+            }
         }
-    }
 
-    CLOSE_SOCKET(sock);
-
-    this->module_to_mdns.clear();
-
-    for (const auto &response : responses) {
-        if (const auto parsed_response = parse_response(response->data(), response->size());
-            parsed_response.has_value()) {
-            modules.insert(parsed_response.value().id);
-            this->module_to_mdns.insert({parsed_response.value().id, parsed_response.value()});
+        fd_set read_set;
+        FD_ZERO(&read_set);
+        FD_SET(sock, &read_set);
+        timeval tv{};
+        if (len <= 0 || select(static_cast<int>(sock) + 1, &read_set, nullptr, nullptr, &tv) <= 0) {
+            return;
         }
     }
-
-    return modules;
-}
-
-std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
-mDNSDiscoveryService::get_lossy_clients(
-    const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
-    std::vector<uint8_t> &skip_modules) {
-    return this->create_clients<UDPClient>(rx_queue, skip_modules);
 }
 
-std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
-mDNSDiscoveryService::get_lossless_clients(
-    const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
-    std::vector<uint8_t> &skip_modules) {
-    return this->create_clients<TCPClient>(rx_queue, skip_modules);
+void mDNSDiscoveryService::handle_response(const mDNSResponse &response) {
+    if (const auto change = m_registry.update(response.module, response.ttl, response.instance,
+                                              response.ptr_ttl);
+        change.has_value()) {
+        notify(change->event, change->module);
+        save_cache();
+        reset_query_backoff();
+    }
 }
 
-template <typename T>
-std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
-mDNSDiscoveryService::create_clients(
-    const std::shared_ptr<BlockingQueue<std::unique_ptr<std::vector<uint8_t>>>> &rx_queue,
-    std::vector<uint8_t> &skip_modules) {
-    std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>> clients;
-
-    for (const auto &[id, module] : this->module_to_mdns) {
-        if (std::find(skip_modules.begin(), skip_modules.end(), id) != skip_modules.end()) {
-            continue;
-        }
-
-        const auto client = std::make_shared<T>(module.ip, rx_queue);
-        client->init();
-
-        for (const auto &connected_module : module.connected_module_ids) {
-            // todo: add only if not connected directly
-            clients[connected_module] = client;
-        }
-
-        clients[id] = client;
+void mDNSDiscoveryService::expire_modules() {
+    const auto expired = m_registry.expire();
+    for (const auto &module : expired) {
+        spdlog::info("[mDNS] Module {} expired", module.id);
+        notify(ModuleEvent::Removed, module);
     }
 
-    return clients;
+    if (!expired.empty()) {
+        save_cache();
+        reset_query_backoff();
+    }
 }
 
-void mDNSDiscoveryService::send_mdns_query(const socket_t sock, const sockaddr_in &addr) {
-    query_header header{};
-    header.id = htons(0);
-    header.flags = htons(0x0000);
-    header.num_questions = htons(1);
-    header.num_answers = htons(0);
-    header.num_authority = htons(0);
-    header.num_additional = htons(0);
-
-    constexpr uint8_t domain_name[] = {
-        13,  '_', 'r', 'o', 'b', 'o', 't', 'c', 'o', 'n', 't', 'r', 'o',
-        'l', 4,   '_', 't', 'c', 'p', 5,   'l', 'o', 'c', 'a', 'l', 0,
-    };
-
-    query_footer footer;
-    footer.type = htons(0x00FF);
-    footer.class_id = htons(0x0001);
-
-    uint8_t buffer[1024] = {};
-    memcpy(buffer, &header, sizeof(header));
-    memcpy(buffer + sizeof(header), &domain_name, sizeof(domain_name));
-    memcpy(buffer + sizeof(header) + sizeof(domain_name), &footer, sizeof(footer));
-#ifdef _WIN32
-    sendto(sock, (char *)&buffer, sizeof(header) + sizeof(domain_name) + sizeof(footer), 0,
-           (sockaddr *)&addr, sizeof(addr));
-#else
-    sendto(sock, &buffer, sizeof(header) + sizeof(domain_name) + sizeof(footer), 0,
-           (sockaddr *)&addr, sizeof(addr));
-#endif
+// The backoff never goes past half the shortest TTL, so even with a lost refresh every record
+// is asked for again before it runs out.
+std::chrono::steady_clock::duration mDNSDiscoveryService::max_query_interval() const {
+    std::chrono::steady_clock::duration interval = MAX_QUERY_INTERVAL;
+    if (const auto ttl = m_registry.shortest_ttl()) {
+        interval = std::min<std::chrono::steady_clock::duration>(interval, *ttl / 2);
+    }
+    return std::max<std::chrono::steady_clock::duration>(interval, QUERY_INTERVAL);
 }
 
-std::optional<mDNSRobotModule> mDNSDiscoveryService::parse_response(uint8_t *buffer,
-                                                                    const int size) {
-    int ptr = 0;
-    mDNSRobotModule response{};
+void mDNSDiscoveryService::reset_query_backoff() {
+    // The fleet is changing, look again soon in case more is going on.
+    m_query_interval = QUERY_INTERVAL;
+    m_next_query = std::min(m_next_query, std::chrono::steady_clock::now() + QUERY_INTERVAL);
+}
 
-    // Header
-    if (size < sizeof(query_header)) {
-        return std::nullopt;
+void mDNSDiscoveryService::save_cache() {
+    if (m_cache_path) {
+        DiscoveryCache::save(*m_cache_path, m_registry.modules());
     }
-    const auto h = reinterpret_cast<query_header *>(buffer + ptr);
-    ptr += sizeof(query_header);
-    h->num_questions = ntohs(h->num_questions);
-    h->num_answers = ntohs(h->num_answers);
-    h->num_authority = ntohs(h->num_authority);
-    h->num_additional = ntohs(h->num_additional);
-
-    // Questions
-    for (int i = 0; i < h->num_questions; i++) {
-        if (ptr > size) {
-            return std::nullopt;
-        }
+}
 
-        // We ignore questions for now
-        auto [name, new_ptr] = read_mdns_name(buffer, size, ptr);
-        if (new_ptr < 1) {
-            return std::nullopt;
-        }
-        ptr = new_ptr;
-        ptr += sizeof(query_footer);
+void mDNSDiscoveryService::notify(const ModuleEvent event, const mDNSRobotModule &module) {
+    std::scoped_lock lock(m_callback_mutex);
+    for (const auto &callback : m_callbacks) {
+        callback(event, module);
     }
+}
 
-    // Answers and authority (we do not care about authority).
-    bool robot_module = false;
-    for (int i = 0; i < h->num_answers + h->num_authority + h->num_additional; i++) {
-        if (ptr > size) {
-            return std::nullopt;
-        }
-        // We assume that the boards mdns does not send any questions asking for
-        // other boards (and thus does not compress the domain name we are looking
-        // for).
-
-        const auto [name, new_ptr] = read_mdns_name(buffer, size, ptr);
-        if (new_ptr < 1) {
-            return std::nullopt;
-        }
-        ptr = new_ptr;
-
-        robot_module |= name.find("_robotcontrol") != std::string::npos;
-        response.hostname = name;
-
-        const auto a = reinterpret_cast<answer *>(buffer + ptr);
-        a->type = ntohs(a->type);
-        a->answer_class = ntohs(a->answer_class);
-        a->ttl = ntohs(a->ttl);
-        a->data_length = ntohs(a->data_length);
-        ptr += sizeof(answer);
-
-        // A-Record
-        if (a->type == 1 && robot_module) {
-            std::vector<uint8_t> data;
-            data.resize(a->data_length);
-            std::memcpy(data.data(), buffer + ptr, a->data_length);
-
-            std::stringstream ip;
-            for (int j = 0; j < a->data_length; j++) {
-                ip << static_cast<int>(data[j]);
-                if (j < a->data_length - 1) {
-                    ip << '.';
-                }
-            }
-            response.ip = ip.str();
-        }
-
-        // TXT-Recrod
-        if (a->type == 16 && robot_module) {
-            int inner_ptr = ptr;
-            while (inner_ptr < a->data_length + ptr) {
-                const int len = buffer[inner_ptr++];
-                std::string s(reinterpret_cast<char *>(buffer + inner_ptr), len);
-                inner_ptr += len;
-
-                const auto split_string = split(s, '=');
-                if (split_string.size() != 2) {
-                    continue;
-                }
-
-                if (split_string[0] == MODULE_ID_STR) {
-                    if (is_integer(std::string(split_string[1]))) {
-                        response.id = stoi(split_string[1]);
-                    }
-                }
-
-                if (split_string[0] == MODULE_TYPE_STR) {
-                    if (is_integer(std::string(split_string[1]))) {
-                        response.module_type = static_cast<ModuleType>(stoi(split_string[1]));
-                    }
-                }
-
-                if (split_string[0] == CONNECTED_MODULES_STR) {
-                    for (const auto connected_modules = split(split_string[1], ',');
-                         const auto &module_id : connected_modules) {
-                        if (is_integer(module_id)) {
-                            response.connected_module_ids.emplace_back(stoi(module_id));
-                        }
-                    }
-                }
-            }
-        }
-
-        ptr += a->data_length;
-    }
+std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
+mDNSDiscoveryService::get_lossy_clients(
+    const std::shared_ptr<PriorityRxQueue> &rx_queue,
+    std::vector<uint8_t> &skip_modules) {
+    return create_clients<UDPClient>(m_registry.modules(), rx_queue, skip_modules);
+}
 
-    return robot_module && is_valid_ipv4(response.ip) ? std::optional{response} : std::nullopt;
+std::unordered_map<uint8_t, std::shared_ptr<ICommunicationClient>>
+mDNSDiscoveryService::get_lossless_clients(
+    const std::shared_ptr<PriorityRxQueue> &rx_queue,
+    std::vector<uint8_t> &skip_modules) {
+    return create_clients<TCPClient>(m_registry.modules(), rx_queue, skip_modules);
 }
 
-std::tuple<std::string, int> mDNSDiscoveryService::read_mdns_name(const uint8_t *buffer,
-                                                                  const int size, int ptr) {
-    int len = 0;
-    std::stringstream ss;
+void mDNSDiscoveryService::send_mdns_query(const socket_t sock, const sockaddr_in &addr,
+                                           const std::vector<KnownAnswer> &known_answers,
+                                           const bool unicast_response) {
+    uint8_t buffer[QUERY_BUFFER_SIZE];
+    size_t next_answer = 0;
+    bool first_packet = true;
+
+    // Known answers that do not fit continue in further packets, every packet but the last
+    // has the truncated bit set (RFC 6762 7.2).
+    while (first_packet || next_answer < known_answers.size()) {
+        query_writer writer{buffer, sizeof(query_header)};
+        uint16_t num_questions = 0;
+        uint16_t num_answers = 0;
+
+        if (first_packet) {
+            writer.name(SERVICE_NAME);
+            writer.u16(RECORD_TYPE_PTR);
+            writer.u16(CLASS_IN | (unicast_response ? CLASS_UNICAST_RESPONSE : 0));
+            num_questions = 1;
+        }
 
-    int i = 0;
-    while (ptr < size) {
-        if (0 >= len) {
-            if (0 == buffer[ptr]) { // end
-                ptr++;
+        for (; next_answer < known_answers.size(); next_answer++) {
+            const auto &[instance, ttl] = known_answers[next_answer];
+            auto record = writer;
+
+            // The owner is always the service name, which is the first name in the packet.
+            const bool owner = record.offset == sizeof(query_header)
+                                   ? record.name(SERVICE_NAME)
+                                   : record.u16(FIRST_NAME_POINTER);
+            const bool fits = owner && record.u16(RECORD_TYPE_PTR) && record.u16(CLASS_IN) &&
+                              record.u32(static_cast<uint32_t>(ttl.count())) && record.u16(0);
+            const auto data_offset = record.offset;
+            if (!fits || !record.name(instance)) {
                 break;
             }
 
-            if (0 != i) {
-                ss << ".";
-            }
-
-            if (buffer[ptr] >= 0xC0) { // compressed
-                ptr++;
-                if (buffer[ptr] < 0 || buffer[ptr] > ptr) {
-                    return {"", -1};
-                }
-                const auto [name, l] = read_mdns_name(buffer, size, buffer[ptr]);
-                if (l < 1) {
-                    return {"", -1};
-                }
-                ptr++;
-                ss << name;
-                break;
-            }
+            const auto data_length = static_cast<uint16_t>(record.offset - data_offset);
+            buffer[data_offset - 2] = static_cast<uint8_t>(data_length >> 8);
+            buffer[data_offset - 1] = static_cast<uint8_t>(data_length);
+            writer = record;
+            num_answers++;
+        }
 
-            len = buffer[ptr]; // update length
-        } else {
-            len--;
-            ss << buffer[ptr];
+        // An answer that cannot fit even an empty packet is skipped, it can only be malformed.
+        if (!first_packet && num_answers == 0) {
+            next_answer++;
+            continue;
         }
-        ptr++;
 
-        i++;
-    }
+        query_header header{};
+        header.id = htons(0);
+        header.flags = htons(next_answer < known_answers.size() ? FLAG_TRUNCATED : 0);
+        header.num_questions = htons(num_questions);
+        header.num_answers = htons(num_answers);
+        header.num_authority = htons(0);
+        header.num_additional = htons(0);
+        memcpy(buffer, &header, sizeof(header));
 
-    return {ss.str(), ptr};
+#ifdef _WIN32
+        sendto(sock, (char *)&buffer, static_cast<int>(writer.offset), 0, (sockaddr *)&addr,
+               sizeof(addr));
+#else
+        sendto(sock, &buffer, writer.offset, 0, (sockaddr *)&addr, sizeof(addr));
+#endif
+        first_packet = false;
+    }
 }
@@ -0,0 +1,227 @@
+#include <charconv>
+#include <cstring>
+
+#undef min
+#include <algorithm>
+
+#include "mDNSParser.h"
+
+constexpr std::string_view ROBOT_SERVICE = "_robotcontrol";
+constexpr std::string_view MODULE_TYPE_KEY = "module_type";
+constexpr std::string_view MODULE_ID_KEY = "module_id";
+constexpr std::string_view CONNECTED_MODULES_KEY = "connected_modules";
+constexpr std::string_view COMPRESSION_KEY = "compression";
+constexpr std::string_view LZ_COMPRESSION = "lz";
+
+constexpr size_t HEADER_SIZE = 12;
+constexpr size_t QUESTION_FOOTER_SIZE = 4;  // type, class
+constexpr size_t RECORD_HEADER_SIZE = 10;   // type, class, ttl, data length
+constexpr uint16_t RECORD_TYPE_A = 1;
+constexpr uint16_t RECORD_TYPE_PTR = 12;
+constexpr uint16_t RECORD_TYPE_TXT = 16;
+constexpr size_t IPV4_ADDRESS_SIZE = 4;
+constexpr auto MAX_COMPRESSION_JUMPS = 32;
+
+static uint16_t read_u16(const std::span<const uint8_t> packet, const size_t offset) {
+    return static_cast<uint16_t>(packet[offset] << 8 | packet[offset + 1]);
+}
+
+static uint32_t read_u32(const std::span<const uint8_t> packet, const size_t offset) {
+    return static_cast<uint32_t>(read_u16(packet, offset)) << 16 | read_u16(packet, offset + 2);
+}
+
+static std::optional<int> parse_int(const std::string_view s) {
+    int value = 0;
+    const auto [end, error] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (error != std::errc{} || end != s.data() + s.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+static void parse_txt_record(const std::span<const uint8_t> data, mDNSRobotModule &module) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        const size_t length = data[offset++];
+        if (length > data.size() - offset) {
+            return;
+        }
+
+        const std::string_view entry(reinterpret_cast<const char *>(data.data() + offset), length);
+        offset += length;
+
+        const auto separator = entry.find('=');
+        if (separator == std::string_view::npos ||
+            entry.find('=', separator + 1) != std::string_view::npos) {
+            continue;
+        }
+        const auto key = entry.substr(0, separator);
+        auto value = entry.substr(separator + 1);
+
+        if (key == MODULE_ID_KEY) {
+            if (const auto id = parse_int(value)) {
+                module.id = *id;
+            }
+        } else if (key == MODULE_TYPE_KEY) {
+            if (const auto type = parse_int(value)) {
+                module.module_type = static_cast<ModuleType>(*type);
+            }
+        } else if (key == CONNECTED_MODULES_KEY) {
+            while (!value.empty()) {
+                const auto comma = value.find(',');
+                if (const auto id = parse_int(value.substr(0, comma))) {
+                    module.connected_module_ids.emplace_back(*id);
+                }
+                value = comma == std::string_view::npos ? std::string_view{}
+                                                        : value.substr(comma + 1);
+            }
+        } else if (key == COMPRESSION_KEY) {
+            // A list of codecs, so more can be added without breaking older hosts.
+            while (!value.empty()) {
+                const auto comma = value.find(',');
+                module.lz_compression |= value.substr(0, comma) == LZ_COMPRESSION;
+                value = comma == std::string_view::npos ? std::string_view{}
+                                                        : value.substr(comma + 1);
+            }
+        }
+    }
+}
+
+std::optional<mDNSResponse> mDNSParser::parse_response(const std::span<const uint8_t> packet) {
+    if (packet.size() < HEADER_SIZE) {
+        return std::nullopt;
+    }
+
+    const auto num_questions = read_u16(packet, 4);
+    const auto num_records = read_u16(packet, 6) + read_u16(packet, 8) + read_u16(packet, 10);
+    size_t offset = HEADER_SIZE;
+    mDNSName name;
+
+    // We ignore questions
+    for (int i = 0; i < num_questions; i++) {
+        const auto next = read_name(packet, offset, name);
+        if (!next || QUESTION_FOOTER_SIZE > packet.size() - *next) {
+            return std::nullopt;
+        }
+        offset = *next + QUESTION_FOOTER_SIZE;
+    }
+
+    // Answers, authority and additional records. Only keep views into the packet until we
+    // know it is worth building a module from.
+    bool robot_module = false;
+    std::optional<uint32_t> ttl;
+    std::optional<uint32_t> ptr_ttl;
+    std::span<const uint8_t> address;
+    std::span<const uint8_t> txt;
+    mDNSName hostname;
+    mDNSName instance;
+
+    for (int i = 0; i < num_records; i++) {
+        const auto next = read_name(packet, offset, name);
+        if (!next || RECORD_HEADER_SIZE > packet.size() - *next) {
+            return std::nullopt;
+        }
+        offset = *next;
+
+        const auto type = read_u16(packet, offset);
+        const auto record_ttl = read_u32(packet, offset + 4);
+        const auto data_length = read_u16(packet, offset + 8);
+        offset += RECORD_HEADER_SIZE;
+        if (data_length > packet.size() - offset) {
+            return std::nullopt;
+        }
+        const auto data_offset = offset;
+        const auto data = packet.subspan(offset, data_length);
+        offset += data_length;
+
+        robot_module |= name.view().find(ROBOT_SERVICE) != std::string_view::npos;
+        if (!robot_module) {
+            continue;
+        }
+
+        if (type == RECORD_TYPE_A && data_length == IPV4_ADDRESS_SIZE) {
+            address = data;
+            hostname = name;
+            ttl = std::min(ttl.value_or(record_ttl), record_ttl);
+        } else if (type == RECORD_TYPE_TXT) {
+            txt = data;
+            ttl = std::min(ttl.value_or(record_ttl), record_ttl);
+        } else if (type == RECORD_TYPE_PTR) {
+            if (!read_name(packet, data_offset, instance)) {
+                return std::nullopt;
+            }
+            ptr_ttl = record_ttl;
+        }
+    }
+
+    if (!robot_module || address.empty()) {
+        return std::nullopt;
+    }
+
+    char ip[16];
+    char *end = ip;
+    for (size_t i = 0; i < address.size(); i++) {
+        if (i > 0) {
+            *end++ = '.';
+        }
+        end = std::to_chars(end, ip + sizeof(ip), address[i]).ptr;
+    }
+
+    mDNSRobotModule module{};
+    module.ip.assign(ip, end);
+    module.hostname = hostname.view();
+    parse_txt_record(txt, module);
+
+    std::optional<std::chrono::seconds> ptr_ttl_seconds;
+    if (ptr_ttl) {
+        ptr_ttl_seconds = std::chrono::seconds(*ptr_ttl);
+    }
+    return mDNSResponse{std::move(module), std::chrono::seconds(ttl.value_or(0)),
+                        std::string(instance.view()), ptr_ttl_seconds};
+}
+
+std::optional<size_t> mDNSParser::read_name(const std::span<const uint8_t> packet, size_t offset,
+                                            mDNSName &name) {
+    name.length = 0;
+    std::optional<size_t> end;
+    int jumps = 0;
+
+    while (offset < packet.size()) {
+        const uint8_t length = packet[offset];
+
+        if (length == 0) {
+            return end.value_or(offset + 1);
+        }
+
+        // Compression pointer, a 14 bit offset anywhere in the packet. Bounding the number of
+        // jumps guards against pointer loops.
+        if ((length & 0xC0) == 0xC0) {
+            if (offset + 1 >= packet.size() || ++jumps > MAX_COMPRESSION_JUMPS) {
+                return std::nullopt;
+            }
+            if (!end) {
+                end = offset + 2;
+            }
+            offset = (length & 0x3F) << 8 | packet[offset + 1];
+            continue;
+        }
+
+        // 0x40 and 0x80 are reserved label types
+        if (length & 0xC0 || length >= packet.size() - offset) {
+            return std::nullopt;
+        }
+
+        const size_t separator = name.length > 0 ? 1 : 0;
+        if (name.length + separator + length > name.data.size()) {
+            return std::nullopt;
+        }
+        if (separator) {
+            name.data[name.length++] = '.';
+        }
+        std::memcpy(name.data.data() + name.length, packet.data() + offset + 1, length);
+        name.length += length;
+        offset += 1 + length;
+    }
+
+    return std::nullopt;
+}